@@ -3,17 +3,22 @@
  *
  */
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 
 #include "event.h"
+#include "coroutine.h"
+#include "clock.h"
 #include "lcd.h"
 #include "uart.h"
 #include "kap.h"
 #include "fsbus.h"
 #include "switches.h"
 #include "pid.h"
+#include "trace.h"
+#include "fr.h"
 
 #define DEBUG
 #ifdef DEBUG
@@ -277,8 +282,6 @@ static volatile uint8_t pitch_trim;
 
 #define PT_RND	20 /* Round the delta to the nearest PT_RND feet */
 
-static volatile event_handle kap_pt_alert = 0;
-
 static const char pt_txt[3] = { ' ', UDCS_PT_UP, UDCS_PT_DN };
 
 /*
@@ -295,14 +298,12 @@ static volatile uint8_t alt_alert = 0;
 
 
 /*
- * The event to cancel RHS baro display
+ * When the RHS baro display goes back to ALT, msec from clock_now_ms()
  */
-static volatile event_handle kap_baro_cancel;
+#define KAP_BARO_HOLD	2000	// Hold BARO this long to swap HPA/INHG
+#define KAP_BARO_TIME	3000	// Baro display time after the last change
 
-/*
- * The event to cancel baro mode check
- */
-static volatile event_handle baro_mode_check_cancel;
+static volatile uint32_t kap_baro_end;
 
 /*
  * The event to cancel RHS Vertical Speed display
@@ -314,21 +315,6 @@ static volatile event_handle kap_vs_cancel;
  */
 static volatile event_handle kap_vs_pid;
 
-/*
- * The event to cancel blinking of the current roll mode
- */
-static volatile event_handle kap_rm_blink_cancel;
-
-/*
- * The event to cancel blinking of the AP during disabling
- */
-static volatile event_handle kap_ap_blink_cancel;
-
-/*
- * The event control the ALERT flashing
- */
-static volatile event_handle kap_alert;
-
 /*
  * Encoder toggle status
  */
@@ -345,252 +331,193 @@ static volatile uint8_t kap_ap_button = 0; // 0 up, 1 down;
  */
 static void kap_display();
 static void kap_ap_disable();
-static void kap_end_baro();
+static void kap_roll_arm_commit();
 //static void kap_vs_pid_event(void);
 //static void kap_vs_pid_enable(void);
 //static void kap_vs_pid_disable(void);
 
-#define RM_BLINK_ON 2	// Tick number to turn text ON
-#define RM_BLINK_OUT_OF 8 // Number of ticks before we wrap and turn text off
+#define RM_BLINK_ON		1200	// msec the text is ON for
+#define RM_BLINK_OFF	400		// msec the text is OFF for
+#define RM_ARM_TIME		5000	// msec before the armed mode is committed
 
 /*
- * This rountine is used to blink the current roll mode
+ * Blink the current roll mode while a roll mode is armed, then commit it
  */
-
-static void kap_roll_mode_blink()
+CO_THREAD(kap_roll_arm)
 {
-	static uint8_t count = 0;
+	CO_BEGIN(co);
 
-	count++;
-	if (count == RM_BLINK_OUT_OF) {
-		count = 0;
-		lcd_gotoxy(DP_ROLL_MODE);
-		lcd_puts_p(roll_mode_txt[RM_CLR]);
-	}
+	lcd_blink(DP_ROLL_MODE, 3, RM_BLINK_ON, RM_BLINK_OFF);
+	CO_DELAY(co, RM_ARM_TIME);
+	lcd_blink_stop(DP_ROLL_MODE);
 
-	if (count == RM_BLINK_ON) {
-		lcd_gotoxy(DP_ROLL_MODE);
-		lcd_puts_p(roll_mode_txt[roll_mode & ~RM_CHANGED]);
-	}
+	kap_roll_arm_commit();
+
+	CO_END(co);
 }
 
-#define AP_BLINK_ON 6	// Tick number to turn text ON
-#define AP_BLINK_OUT_OF 8 // Number of ticks before we wrap and turn text off
+#define AP_BLINK_ON		1200	// msec the text is ON for
+#define AP_BLINK_OFF	400		// msec the text is OFF for
+#define AP_OFF_TIME		4000	// msec before the AP is fully off
 
 /*
- * This rountine is used to blink AP as it is being disabled
+ * Blink AP as it is being disabled, then clear the display
  */
-static void kap_ap_off_blink()
+CO_THREAD(kap_ap_off)
 {
-	static uint8_t count = 0;
-
-	count++;
-	if (count == AP_BLINK_OUT_OF) {
-		count = 0;
-		lcd_gotoxy(0,0);
-		lcd_puts("AP");
-		//lcd_putc(UDCS_A_BR);
-		//lcd_putc(UDCS_P_BR);
-	}
-
-	if (count == AP_BLINK_ON) {
-		lcd_gotoxy(0,0);
-		lcd_puts("  ");
-	}
-}
+	CO_BEGIN(co);
 
-/*
- * This routine blinks the pitch trim
- */
-#define PT_BLINK_ON 6/ Tick number to turn text ON
-#define PT_BLINK_OUT_OF 8 // Number of ticks before we wrap and turn text off
+	lcd_gotoxy(0,0);
+	lcd_puts("AP");
+	//lcd_putc(UDCS_A_BR);
+	//lcd_putc(UDCS_P_BR);
+	lcd_blink(0, 0, 2, AP_BLINK_ON, AP_BLINK_OFF);
+	CO_DELAY(co, AP_OFF_TIME);
 
-static void kap_pt_display()
-{
-	static uint8_t count = 0;
+	kap_ap_disable();	// lcd_clrscr() stops the blink
 
-	if (pitch_trim == PT_NONE) {
-		lcd_gotoxy(DP_PITCH_TRIM);
-		lcd_putc(' ');
+	CO_END(co);
+}
 
-		event_cancel(&kap_pt_alert);
-		return;
-	}
+#define PT_BLINK_ON		1500	// msec the pitch trim arrow is ON for
+#define PT_BLINK_OFF	500		// msec the pitch trim arrow is OFF for
 
-	count++;
-	if (count == AP_BLINK_OUT_OF) {
-		count = 0;
-		lcd_gotoxy(DP_PITCH_TRIM);
-		lcd_putc(pt_txt[pitch_trim]);
-	}
+#define AL_BLINK_ON		1500	// msec the flashing ALERT is ON for
+#define AL_BLINK_OFF	500		// msec the flashing ALERT is OFF for
 
-	if (count == AP_BLINK_ON) {
-		lcd_gotoxy(DP_PITCH_TRIM);
-		lcd_putc(' ');
-	}
-}
+/******************************* FSBUS CALLBACK ROUTINES ************************************/
 
 /*
- * This routine blinks the pitch trim
+ * The display controllers are mailboxes holding the latest value from the
+ * sim. kap_rcv_displays() looks in each once per display cycle, so however
+ * fast the sim sends there is at most one update of each per cycle.
  */
-#define AL_BLINK_ON 6 // Tick number to turn text ON
-#define AL_BLINK_OUT_OF 8 // Number of ticks before we wrap and turn text off
+static uint8_t kap_alt_seq, kap_air_alt_seq, kap_vs_seq, kap_baro_hpa_seq,
+			   kap_baro_inhg_seq, kap_elev_trim_seq, kap_air_vs_seq;
 
-static void kap_alert_flash()
-{
-	static uint8_t count = 0;
+static fsbus_value_t kap_baro_hpa_val, kap_baro_inhg_val;	// kept for their text
 
-	count++;
-	if (count == AL_BLINK_OUT_OF) {
-		count = 0;
-		lcd_gotoxy(DP_ALERT);
-		lcd_putc('A');
-	}
+/*
+ * Altitude Controller
+ */
+static void kap_rcv_alt()
+{
+	fsbus_value_t v;
 
-	if (count == AL_BLINK_ON) {
-		lcd_gotoxy(DP_ALERT);
-		lcd_putc(' ');
+	if (fsbus_display_read(kap_alt_fs_blk, &v, &kap_alt_seq)) {
+		kap_disp_flags |= KAP_DC_ALT;
+		if (v.fv_valid)
+			alt_rcv = v.fv_value;
 	}
 }
 
-int32_t my_atol(signed char *buff)
+/*
+ * Aircraft Altitude Controller (as opposed to the AP alt)
+ */
+static void kap_rcv_air_alt()
 {
-	int32_t r = 0;
-	uint8_t minus = 0;
-	char c;
+	fsbus_value_t v;
 
-	while ((c = *buff)) {
-		if (isdigit(c)) {
-			r *= 10;
-			r += c - '0';
-		} else if (c == '-')
-			minus = 1;
-		buff++;
+	if (fsbus_display_read(kap_air_alt_fs_blk, &v, &kap_air_alt_seq)) {
+		kap_disp_flags |= KAP_DC_AIR_ALT;
+		if (v.fv_valid)
+			air_alt = v.fv_value;
 	}
-	if (minus)
-		r *= -1;
-	return r;
 }
 
-int16_t my_atoi(signed char *buff)
+/*
+ * VS Controller
+ */
+static void kap_rcv_vs()
 {
-	int16_t r = 0;
-	uint8_t minus = 0;
-	char c;
+	fsbus_value_t v;
 
-	while ((c = *buff)) {
-		if (isdigit(c)) {
-			r *= 10;
-			r += c - '0';
-		} else if (c == '-')
-			minus = 1;
-		buff++;
+	if (fsbus_display_read(kap_vs_fs_blk, &v, &kap_vs_seq)) {
+		kap_disp_flags |= KAP_DC_VS;
+		if (v.fv_valid)
+			vs = v.fv_value;
 	}
-	if (minus)
-		r *= -1;
-	return r;
 }
 
-/******************************* FSBUS CALLBACK ROUTINES ************************************/
-
 /*
- * This is the callback routine for the Altitude Controller
+ * HPA Baro Controller
  */
-static void kap_rcv_alt()
+static void kap_rcv_baro_hpa()
 {
-//	printf("kap_rcv_alt - enter\n\r");
-	kap_disp_flags |= KAP_DC_ALT;
-	alt_rcv = my_atol((signed char *)kap_alt_fs_blk->fs_display.fs_digits);
-//	alt_disp = alt_rcv;
-//	printf("kap_rcv_alt - exit\n\r");
+	if (fsbus_display_read(kap_baro_hpa_fs_blk, &kap_baro_hpa_val, &kap_baro_hpa_seq)) {
+		kap_disp_flags |= KAP_DC_BARO_HPA;
+		if (kap_baro_hpa_val.fv_valid)
+			baro_hpa = kap_baro_hpa_val.fv_value;
+	}
 }
 
 /*
- * This is the callback routine for the Aircraft Altitude Controller (as opposed to the AP alt)
+ * inhg Baro Controller
  */
-static void kap_rcv_air_alt()
+static void kap_rcv_baro_inhg()
 {
-//	printf("kap_rcv_air_alt - enter\n\r");
-	kap_disp_flags |= KAP_DC_AIR_ALT;
-	air_alt = my_atol((signed char *)kap_air_alt_fs_blk->fs_display.fs_digits);
-//	printf("kap_rcv_air_alt - %d exit\n\r", air_alt);
+	if (fsbus_display_read(kap_baro_inhg_fs_blk, &kap_baro_inhg_val, &kap_baro_inhg_seq)) {
+		kap_disp_flags |= KAP_DC_BARO_INHG;
+		if (kap_baro_inhg_val.fv_valid)
+			baro_inhg = kap_baro_inhg_val.fv_value;
+	}
 }
 
 /*
- * This is the callback routine for the VS Controller
+ * Elevator Trim Controller
  */
-static void kap_rcv_vs()
+static void kap_rcv_elev_trim()
 {
-//	printf("kap_rcv_vs - enter\n\r");
-	kap_disp_flags |= KAP_DC_VS;
-	vs = my_atoi((signed char *)kap_vs_fs_blk->fs_display.fs_digits);
-//	printf("kap_rcv_vs - exit\n\r");
+	fsbus_value_t v;
+
+	if (fsbus_display_read(kap_elev_trim_blk, &v, &kap_elev_trim_seq) && v.fv_valid)
+		elev_trim = v.fv_value;
 }
 
 /*
- * This is the callback routine for the HPA Baro Controller
+ * Aircrafts Vertical Speed Controller
  */
-static void kap_rcv_baro_hpa()
+static void kap_rcv_air_vs()
 {
-//	printf("kap_rcv_baro_hpa - enter\n\r");
-	kap_disp_flags |= KAP_DC_BARO_HPA;
-	baro_hpa = my_atoi((signed char *)kap_baro_hpa_fs_blk->fs_display.fs_digits);
-//	printf("kap_rcv_baro_hpa - exit\n\r");
+	fsbus_value_t v;
+
+	if (fsbus_display_read(kap_air_vs_blk, &v, &kap_air_vs_seq) && v.fv_valid)
+		air_vs = v.fv_value;
 }
 
 /*
- * This is the callback routine for the inhg Baro Controller
+ * Take the latest from every display controller, at the start of a display
+ * cycle
  */
-static void kap_rcv_baro_inhg()
+static void kap_rcv_displays()
 {
-//	printf("kap_rcv_baro_inhg - enter\n\r");
-	kap_disp_flags |= KAP_DC_BARO_INHG;
-	baro_inhg = my_atoi((signed char *)kap_baro_inhg_fs_blk->fs_display.fs_digits);
-//	printf("kap_rcv_baro_inhg - exit\n\r");
+	kap_rcv_alt();
+	kap_rcv_air_alt();
+	kap_rcv_vs();
+	kap_rcv_baro_hpa();
+	kap_rcv_baro_inhg();
+	kap_rcv_elev_trim();
+	kap_rcv_air_vs();
 }
 
-
 /*
- * This is the callback routine for the inhg Baro Controller
+ * This is the callback routine for the DIO Controller, called for every
+ * command since the AP disconnect comes this way
  */
 static void kap_rcv_dio()
 {
-	printf("kap_rcv_dio - enter\n\r");
+	trace_debug(KAP, "kap_rcv_dio - enter\n\r");
 //	kap_dio_flags |= KAP_DIO_CHANGED;
 
-	printf("kap_rcv_dio: DIO Port A: 0x%x\n\r", kap_dio_blk->fs_dio.fs_dout[0]);
+	trace_debug(KAP, "kap_rcv_dio: DIO Port A: 0x%x\n\r", kap_dio_blk->fs_dio.fs_dout[0]);
 
 	// Only deal with the AP being turned off
 	if (!(kap_dio_blk->fs_dio.fs_dout[0] & FSX_AP)) {
-		printf("kap_rcv_dio - AP NOW OFF!!!!\n\r");
+		trace_info(KAP, "kap_rcv_dio - AP NOW OFF!!!!\n\r");
 		kap_ap_disable();
 	}
 
-	printf("kap_rcv_dio - exit\n\r");
-}
-
-/*
- * This is the callback routine for the the Elevator Trim Controller
- */
-static void kap_rcv_elev_trim()
-{
-//	printf("kap_rcv_elev_trim - enter\n\r");
-
-	elev_trim = my_atoi((signed char *)kap_elev_trim_blk->fs_display.fs_digits);
-
-//	printf("kap_rcv_elev_trim - exit\n\r");
-}
-
-/*
- * This is the callback routine for the Aircrafts Vertical Speed Controller
- */
-static void kap_rcv_air_vs()
-{
-//	printf("kap_rcv_air_vs - enter\n\r");
-	
-	air_vs = my_atoi((signed char *)kap_air_vs_blk->fs_display.fs_digits);
-
-//	printf("kap_rcv_air_vs - exit\n\r");
+	trace_debug(KAP, "kap_rcv_dio - exit\n\r");
 }
 
 /******************************* BUTTON ROUTINES ************************************/
@@ -609,7 +536,8 @@ static void kap_rcv_air_vs()
  */
 static void kap_button_up()
 {
-	printf("kap_button_up()\n\r");
+	trace_info(KAP, "kap_button_up()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_UP, ap_mode << 8 | rhs_mode);
 	if ((pitch_mode & ~PM_CHANGED) != PM_GS) {
 
 		if ((rhs_mode & ~RHS_CHANGED) == RHS_VS) {
@@ -631,7 +559,8 @@ static void kap_button_up()
 
 static void kap_button_down()
 {
-	printf("kap_button_down()\n\r");
+	trace_info(KAP, "kap_button_down()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_DOWN, ap_mode << 8 | rhs_mode);
 	if ((pitch_mode & ~PM_CHANGED) != PM_GS) {
 
 		if ((rhs_mode & ~RHS_CHANGED) == RHS_VS) {
@@ -654,7 +583,8 @@ static void kap_button_down()
 
 static void kap_button_encoder_toggle()
 {
-	printf("kap_button_encoder_toggle()\n\r");
+	trace_info(KAP, "kap_button_encoder_toggle()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_TOGGLE, ap_mode << 8 | rhs_mode);
 
 	if ((rhs_mode & ~RHS_CHANGED) != RHS_BARO) {
 
@@ -666,9 +596,27 @@ static void kap_button_encoder_toggle()
 }
 
 
-static void baro_mode_check()
+/*
+ * Put off the end of the baro display, the user is still busy with it
+ */
+static void kap_baro_touch()
+{
+	kap_baro_end = clock_now_ms() + KAP_BARO_TIME;
+}
+
+/*
+ * The baro display. Swaps HPA/INHG if BARO is still held after
+ * KAP_BARO_HOLD, then reverts to the altitude once it's been left alone
+ * for KAP_BARO_TIME.
+ */
+CO_THREAD(kap_baro)
 {
-	printf("baro_mode_check() - enter\n\r");
+	CO_BEGIN(co);
+
+	kap_baro_touch();
+	CO_DELAY(co, KAP_BARO_HOLD);
+
+	trace_debug(KAP, "kap_baro: hold check\n\r");
 
 	if (sw_porta_state & _BV(1)) {
 		// Still pressed
@@ -679,14 +627,23 @@ static void baro_mode_check()
 			baro_mode = BARO_HPA;
 
 		// Reset the switch back to VS/ALT
-		event_reset(kap_baro_cancel);
+		kap_baro_touch();
 
 		rhs_mode |= RHS_CHANGED;
 	}
 
-	baro_mode_check_cancel = 0;
+	while ((int32_t)(kap_baro_end - clock_now_ms()) > 0)
+		CO_DELAY(co, kap_baro_end - clock_now_ms());
 
-	printf("baro_mode_check() - exit\n\r");
+	if ((rhs_mode & ~RHS_CHANGED) == RHS_BARO) {
+
+		trace_info(KAP, "kap_baro: baro ended\n\r");
+
+		rhs_mode = RHS_ALT | RHS_CHANGED;
+		kap_disp_flags = 0xFF;
+	}
+
+	CO_END(co);
 }
 
 
@@ -696,12 +653,13 @@ static void baro_mode_check()
  */
 static void kap_button_baro()
 {
-	printf("kap_button_baro()\n\r");
+	trace_info(KAP, "kap_button_baro()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_BARO, ap_mode << 8 | rhs_mode);
 
 	if ((rhs_mode & ~RHS_CHANGED) != RHS_BARO) {
 		rhs_mode = RHS_CHANGED | RHS_BARO;
 
-		baro_mode_check_cancel = event_register(baro_mode_check, EVENT_HZ * 2, 1);
+		CO_START(kap_baro);
 	}
 }
 
@@ -710,7 +668,8 @@ static void kap_button_baro()
  */
 static void kap_button_arm()
 {
-	printf("kap_button_arm()\n\r");
+	trace_info(KAP, "kap_button_arm()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_ARM, ap_mode << 8 | rhs_mode);
 
 	if ((pitch_arm_mode & ~PM_CHANGED) == PM_CLR)
 		pitch_arm_mode = PM_ALT | PM_CHANGED;
@@ -731,7 +690,7 @@ static void kap_button_arm()
  */
 static void kap_ap_on()
 {
-	printf("kap_ap_on() - enter\n\r");
+	trace_debug(KAP, "kap_ap_on() - enter\n\r");
 
 	if (sw_porta_state & _BV(5)) {
 		// Still pressed
@@ -742,14 +701,15 @@ static void kap_ap_on()
 	}
 	ap_mode &= ~AP_TRANSITION;
 
-	printf("kap_ap_on() - exit\n\r");
+	trace_debug(KAP, "kap_ap_on() - exit\n\r");
 }
 
 
 
 static void kap_button_ap()
 {
-	printf("kap_button_ap()\n\r");
+	trace_info(KAP, "kap_button_ap()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_AP, ap_mode << 8 | rhs_mode);
 
 	// Ignore key presses whilst transitioning
 	if (ap_mode & AP_TRANSITION)
@@ -758,7 +718,7 @@ static void kap_button_ap()
 	if ((ap_mode & AP_MODE) == AP_DISABLED) {
 		// Check button still pressed 0.25 seconds from now,
 		ap_mode |= AP_TRANSITION;
-		event_register(kap_ap_on, EVENT_HZ / 4, 1);
+		event_register_flags(kap_ap_on, 250, 1, EVENT_PRIO_HIGH);
 	} else {
 		ap_mode = AP_DISABLED | AP_CHANGED | AP_TRANSITION; // Not fully off until blinking done
 	}
@@ -774,7 +734,8 @@ static void kap_button_ap()
  */
 static void kap_button_hdg()
 {
-	printf("kap_button_hdg()\n\r");
+	trace_info(KAP, "kap_button_hdg()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_HDG, ap_mode << 8 | rhs_mode);
 
 	if ((roll_mode & ~RM_CHANGED) == RM_ROL) {
 		roll_mode = RM_HDG | RM_CHANGED;
@@ -798,7 +759,8 @@ static void kap_button_hdg()
  */
 static void kap_button_nav()
 {
-	printf("kap_button_nav()\n\r");
+	trace_info(KAP, "kap_button_nav()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_NAV, ap_mode << 8 | rhs_mode);
 
 	/* We can switch from ROL mode, but not other modes */
 
@@ -819,7 +781,8 @@ static void kap_button_nav()
  */
 static void kap_button_apr()
 {
-	printf("kap_button_apr()\n\r");
+	trace_info(KAP, "kap_button_apr()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_APR, ap_mode << 8 | rhs_mode);
 	/* We can switch from ROL mode, but not other modes */
 
 	if ((roll_mode & ~RM_CHANGED) == RM_ROL)
@@ -837,7 +800,8 @@ static void kap_button_apr()
 
 static void kap_button_enc(int8_t delta)
 {
-	printf("kap_button_enc(%d)\n\r", delta);
+	trace_info(KAP, "kap_button_enc(%d)\n\r", delta);
+	fr_log(FR_BUTTON, FR_BTN_ENC, delta);
 
 
 	if ((rhs_mode & ~RHS_CHANGED) != RHS_BARO) {
@@ -858,7 +822,7 @@ static void kap_button_enc(int8_t delta)
 
 	} else {
 
-		event_reset(kap_baro_cancel);
+		kap_baro_touch();
 
 		if (baro_mode == BARO_HPA)
 			fsbus_snd(KAP_DIO_CID, DIO_SW_BARO_HPA, delta, 3);
@@ -876,7 +840,8 @@ static void kap_button_enc(int8_t delta)
  */
 static void kap_button_alt()
 {
-	printf("kap_button_alt()\n\r");
+	trace_info(KAP, "kap_button_alt()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_ALT, ap_mode << 8 | rhs_mode);
 
 	// Toggle the pitch mode
 
@@ -906,7 +871,8 @@ static void kap_button_alt()
  (*/
 static void kap_button_rev()
 {
-	printf("kap_button_rev()\n\r");
+	trace_info(KAP, "kap_button_rev()\n\r");
+	fr_log(FR_BUTTON, FR_BTN_REV, ap_mode << 8 | rhs_mode);
 	/* We can switch from ROL mode, but not other modes */
 
 	if ((roll_mode & ~RM_CHANGED) == RM_ROL)
@@ -1026,14 +992,14 @@ static void kap_vs_end()
 {
 	kap_vs_cancel = 0;
 
-	printf("kap_vs_end() - rhs_mode =0x%x\n\r", rhs_mode);
+	trace_debug(KAP, "kap_vs_end() - rhs_mode =0x%x\n\r", rhs_mode);
 	if ((rhs_mode & ~RHS_CHANGED) == RHS_VS) {
-		printf("kap_vs_end() - vs mode ending - back to ALT\n\r");
+		trace_info(KAP, "kap_vs_end() - vs mode ending - back to ALT\n\r");
 
 		rhs_mode = RHS_ALT | RHS_CHANGED;
 	}
 	
-	printf("kap_vs_end() - exit\n\r");
+	trace_debug(KAP, "kap_vs_end() - exit\n\r");
 }
 
 
@@ -1105,12 +1071,12 @@ static void inline kap_displ_vs()
 		lcd_putc(UDCS_P);
 		lcd_putc(UDCS_M);
 
-		printf("kap_displ_vs - setup for kap_vs_end - 3 seconds\n\r");
+		trace_debug(DISPLAY, "kap_displ_vs - setup for kap_vs_end - 3 seconds\n\r");
 
 		// Revert after 3 seconds
-		kap_vs_cancel = event_register(kap_vs_end, 3 * EVENT_HZ, 1);
+		kap_vs_cancel = event_register(kap_vs_end, 3000, 1);
 
-		printf("kap_displ_vs - event handle = %d\n\r", kap_vs_cancel);
+		trace_debug(DISPLAY, "kap_displ_vs - event handle = %d\n\r", kap_vs_cancel);
 
 	}
 
@@ -1118,7 +1084,7 @@ static void inline kap_displ_vs()
 
 		lcd_gotoxy(DP_RHS);
 
-		printf("kap_displ_vs: vs = %d\n\r", vs);
+		trace_debug(DISPLAY, "kap_displ_vs: vs = %d\n\r", vs);
 
 		displ_val(out_buf, vs);
 
@@ -1171,11 +1137,13 @@ static void inline kap_displ_alt()
 
 static void inline kap_displ_baro_hpa()
 {
+	char buf[FS_VALUE_STR];
+
 	//printf("kap_displ_baro_hpa - enter\n\r");
 
 	if (kap_disp_flags & KAP_DC_BARO_HPA) {
 		lcd_gotoxy(DP_RHS);
-		lcd_puts((const char *)kap_baro_hpa_fs_blk->fs_display.fs_digits);
+		lcd_puts(fsbus_value_str(&kap_baro_hpa_val, buf));
 
 		kap_disp_flags ^= KAP_DC_BARO_HPA;
 	}
@@ -1186,11 +1154,13 @@ static void inline kap_displ_baro_hpa()
 
 static void inline kap_displ_baro_inhg()
 {
+	char buf[FS_VALUE_STR];
+
 	//printf("kap_displ_baro_inhg - enter\n\r");
 
 	if (kap_disp_flags & KAP_DC_BARO_INHG) {
 		lcd_gotoxy(DP_RHS);
-		lcd_puts((const char *)kap_baro_inhg_fs_blk->fs_display.fs_digits);
+		lcd_puts(fsbus_value_str(&kap_baro_inhg_val, buf));
 
 		kap_disp_flags ^= KAP_DC_BARO_INHG;
 	}
@@ -1255,12 +1225,6 @@ static void kap_roll_arm_commit()
 {
 //printf("kap_roll_arm_commit: enter, roll_mode = 0x%x, roll_arm_mode = 0x%x\n\r", roll_mode, roll_arm_mode);
 
-	// Cancel HDG blink
-
-	if (kap_rm_blink_cancel) {
-		event_cancel(&kap_rm_blink_cancel);
-	}
-
 	roll_mode = roll_arm_mode | RM_CHANGED;
 	roll_arm_mode = RM_CLR | RM_CHANGED;
 
@@ -1290,9 +1254,7 @@ static void kap_display_roll_arm()
 
 //printf("kap_display_roll_arm: Setup blinking and commit callback\n\r");
 
-			kap_rm_blink_cancel = event_register(kap_roll_mode_blink, EVENT_HZ / 5, 0);
-
-			event_register(kap_roll_arm_commit, 5 * EVENT_HZ, 1);
+			CO_START(kap_roll_arm);
 
 		}
 	}
@@ -1403,25 +1365,6 @@ static void kap_display_pitch_arm()
 	}
 }
 
-/*
- * Revert from Barometer mode to pitch
- */
-static void kap_end_baro()
-{
-	kap_baro_cancel = 0;
-//	printf("kap_end_baro: enter\n\r");
-
-	if ((rhs_mode & ~RHS_CHANGED) == RHS_BARO) {
-
-		printf("kap_end_baro: baro ended\n\r");
-
-		rhs_mode = RHS_ALT | RHS_CHANGED;
-		kap_disp_flags = 0xFF;
-	}
-
-//	printf("kap_end_baro: exit\n\r");
-}
-
 /*
  * Display the barometer mode information
  */
@@ -1432,7 +1375,7 @@ static void kap_display_baro()
 	if (rhs_mode & RHS_CHANGED) {
 		rhs_mode &= ~RHS_CHANGED;
 
-		printf("kap_display_baro: Mode recently changed\n\r");
+		trace_debug(DISPLAY, "kap_display_baro: Mode recently changed\n\r");
 
 		lcd_gotoxy(13, 1);
 ///************
@@ -1443,9 +1386,6 @@ static void kap_display_baro()
 		else
 			lcd_puts("INHG");
 
-		// End baro mode in 3 seconds (unless someone changes it)
-		kap_baro_cancel = event_register(kap_end_baro, 3 * EVENT_HZ, 1);
-
 		kap_disp_flags = 0xFF; // Let the display routines update the digits
 	}
 
@@ -1481,10 +1421,7 @@ static void kap_display_rhs()
  */
 static void kap_ap_disable()
 {
-
-	if (kap_ap_blink_cancel)
-		event_cancel(&kap_ap_blink_cancel);
-
+	CO_STOP(kap_ap_off);
 
 	lcd_clrscr();
 	ap_mode = AP_DISABLED;
@@ -1494,6 +1431,9 @@ static void kap_ap_disable()
 
 static void kap_extingush_alert()
 {
+	if (alt_alert & ALT_200_1000)
+		return;		// Already flashing again, leave the A to lcd_blink()
+
 	lcd_gotoxy(DP_ALERT);
 	lcd_puts(" ");
 }
@@ -1503,6 +1443,7 @@ static void kap_display_alerts()
 {
 	//printf("kap_display_alerts - enter\n\r");
 	int32_t delta;
+	uint8_t pt;
 
 	if (kap_disp_flags & KAP_DC_AIR_ALT) {
 		//lcd_gotoxy(10, 0);
@@ -1519,19 +1460,22 @@ static void kap_display_alerts()
 
 	/* Pitch Trim alerts */
 
-	if (delta > 0) {
-		// Up
-		pitch_trim = PT_UP;
-		if (!kap_pt_alert)
-			kap_pt_alert = event_register(kap_pt_display, EVENT_HZ / 4, 0);
-	} else if (delta < 0) {
-		// Down
-		pitch_trim = PT_DOWN;
-		if (!kap_pt_alert)
-			kap_pt_alert = event_register(kap_pt_display, EVENT_HZ / 4, 0);
-	} else {
-		// Level
-		pitch_trim = PT_NONE;
+	if (delta > 0)
+		pt = PT_UP;
+	else if (delta < 0)
+		pt = PT_DOWN;
+	else
+		pt = PT_NONE;	// Level
+
+	if (pt != pitch_trim) {
+		if (pitch_trim == PT_NONE)
+			lcd_blink(DP_PITCH_TRIM, 1, PT_BLINK_ON, PT_BLINK_OFF);
+		else if (pt == PT_NONE)
+			lcd_blink_stop(DP_PITCH_TRIM);
+		pitch_trim = pt;
+
+		lcd_gotoxy(DP_PITCH_TRIM);
+		lcd_putc(pt_txt[pitch_trim]);
 	}
 	
 	/* Altitude alerts */
@@ -1552,11 +1496,16 @@ static void kap_display_alerts()
 		if (delta > 200 && delta <= 1000) {
 			if ((alt_alert & ~ALT_REACHED) != ALT_200_1000) {
 				alt_alert = ALT_200_1000 | ALT_REACHED;
-				kap_alert = event_register(kap_alert_flash, EVENT_HZ / 4, 0);
+				lcd_gotoxy(DP_ALERT);
+				lcd_putc('A');
+				lcd_blink(DP_ALERT, 1, AL_BLINK_ON, AL_BLINK_OFF);
 			}
 		} else {
-			if (kap_alert)
-				event_cancel(&kap_alert);
+			if (alt_alert & ALT_200_1000) {
+				lcd_blink_stop(DP_ALERT);
+				lcd_gotoxy(DP_ALERT);
+				lcd_putc(' ');
+			}
 
 			if (delta >= 1000)
 				alt_alert = 0;
@@ -1572,7 +1521,7 @@ static void kap_display_alerts()
 			// Illuminate ALERT momentarily
 			lcd_gotoxy(DP_ALERT);
 			lcd_puts("A");
-			event_register(kap_extingush_alert, EVENT_HZ, 1);
+			event_register_flags(kap_extingush_alert, 1000, 1, EVENT_PRIO_LOW);
 
 		} else if (delta > 200 && delta <= 1000) {
 			// Illuminate ALERT continuously
@@ -1603,6 +1552,8 @@ static void kap_display_alerts()
  */
 static void kap_display()
 {	
+	kap_rcv_displays();
+
 	// Auto pilot enabled status
 	if (ap_mode & AP_CHANGED) {
 		if ((ap_mode & AP_MODE) == AP_ENABLED) {
@@ -1634,29 +1585,24 @@ static void kap_display()
 			// Tell FSBUS that we are now enabled
 			fsbus_snd(KAP_DIO_CID, DIO_SW_APMASTER, 0, 3);
 
-			// Disable potential events
-			if (kap_pt_alert)
-				event_cancel(&kap_pt_alert);
+			// Disable potential events. lcd_clrscr() has stopped the
+			// blinking, so have it started again when the AP comes back
+			pitch_trim = PT_NONE;
+			alt_alert &= ~ALT_200_1000;
 
-			if (kap_baro_cancel)
-				event_cancel(&kap_baro_cancel);
+			CO_STOP(kap_baro);
 
 			if (kap_vs_cancel)
 				event_cancel(&kap_vs_cancel);
 
-			if (kap_rm_blink_cancel)
-				event_cancel(&kap_rm_blink_cancel);
+			CO_STOP(kap_roll_arm);
 
 			if (kap_vs_pid)
 				event_cancel(&kap_vs_pid);
 
-			if (kap_alert)
-				event_cancel(&kap_alert);
+			// Blink AP, then off
 
-			// Blink AP
-
-			kap_ap_blink_cancel = event_register(kap_ap_off_blink, EVENT_HZ / 5, 0);
-			event_register(kap_ap_disable, 4 * EVENT_HZ, 1);
+			CO_START(kap_ap_off);
 		}
 		ap_mode ^= AP_CHANGED;
 	}
@@ -1680,12 +1626,21 @@ static void kap_display()
 
 /************************************ PID Code for VS mode ascent and decents ******************************/
 
-#ifdef NOT
-
 #define K_P     0.10
 #define K_I     0.00
 #define K_D     0.00
 
+/*
+ * The gains, times SCALING_FACTOR. Set from the console with kap_pid_set().
+ * The VS PID below is compiled out (#ifdef NOT) and nothing else reads
+ * these, so for now they only hold the values until it is put back.
+ */
+static int16_t kap_pid_p = K_P * SCALING_FACTOR,
+			   kap_pid_i = K_I * SCALING_FACTOR,
+			   kap_pid_d = K_D * SCALING_FACTOR;
+
+#ifdef NOT
+
 //Parameters for regulator
 static struct PID_DATA pidData;
 
@@ -1695,40 +1650,145 @@ static void kap_vs_pid_event(void)
 {
 	int16_t inputValue;
 
-printf("kap_vs_pid_event - enter\n\r");
+trace_debug(KAP, "kap_vs_pid_event - enter\n\r");
 
 	inputValue = pid_Controller(vs, air_vs, &pidData);
 
-printf("kap_vs_pid_event: vs %d, air_vs %d, inputValue %d\n\r", vs, air_vs, inputValue);
+trace_debug(KAP, "kap_vs_pid_event: vs %d, air_vs %d, inputValue %d\n\r", vs, air_vs, inputValue);
 
 	//Set_Input(inputValue);
 
 	fsbus_snd(KAP_DIO_CID, DIO_SW_ELEV_TRIM, inputValue, 3);
 
-printf("kap_vs_pid_event - exit\n\r");
+trace_debug(KAP, "kap_vs_pid_event - exit\n\r");
 }
 
 static void kap_vs_pid_enable(void)
 {
-printf("kap_vs_pid_enable - enter\n\r");
+trace_debug(KAP, "kap_vs_pid_enable - enter\n\r");
 
-	pid_Init(K_P * SCALING_FACTOR, K_I * SCALING_FACTOR , K_D * SCALING_FACTOR , &pidData);
+	pid_Init(kap_pid_p, kap_pid_i, kap_pid_d, &pidData);
 
-	kap_vs_pid = event_register(kap_vs_pid_event, EVENT_HZ * 1, 0);
-printf("kap_vs_pid_enable - exit\n\r");
+	kap_vs_pid = event_register(kap_vs_pid_event, 1000, 0);
+trace_debug(KAP, "kap_vs_pid_enable - exit\n\r");
 }
 
 static void kap_vs_pid_disable(void)
 {
-printf("kap_vs_pid_disable - enter\n\r");
+trace_debug(KAP, "kap_vs_pid_disable - enter\n\r");
 	event_cancel(&kap_vs_pid);
-printf("kap_vs_pid_disable - exit\n\r");
+trace_debug(KAP, "kap_vs_pid_disable - exit\n\r");
 }
 
 #endif
 
+void kap_pid_get(int16_t *p, int16_t *i, int16_t *d)
+{
+	*p = kap_pid_p;
+	*i = kap_pid_i;
+	*d = kap_pid_d;
+}
+
+/*
+ * Change the gains. They would reach a running PID straight away, but the
+ * PID is compiled out, so this only stores them.
+ */
+void kap_pid_set(int16_t p, int16_t i, int16_t d)
+{
+	kap_pid_p = p;
+	kap_pid_i = i;
+	kap_pid_d = d;
+#ifdef NOT
+	pidData.P_Factor = p;
+	pidData.I_Factor = i;
+	pidData.D_Factor = d;
+#endif
+}
+
 /************************************ END PID *******************************************/
 
+/*
+ * The state the console can look at and change, by name
+ */
+typedef struct kap_var_s {
+	char			v_name[15];
+	uint8_t			v_size;		/* 1 (unsigned), 2 or 4 (signed) bytes */
+	volatile void	*v_ptr;
+} kap_var_t;
+
+#define KAP_VAR(v)	{ #v, sizeof(v), &v }
+
+static const kap_var_t kap_vars[] PROGMEM = {
+	KAP_VAR(ap_mode),
+	KAP_VAR(roll_mode),
+	KAP_VAR(roll_arm_mode),
+	KAP_VAR(pitch_mode),
+	KAP_VAR(pitch_arm_mode),
+	KAP_VAR(rhs_mode),
+	KAP_VAR(baro_mode),
+	KAP_VAR(pitch_trim),
+	KAP_VAR(alt_alert),
+	KAP_VAR(fsx_buttons),
+	KAP_VAR(kap_disp_flags),
+	KAP_VAR(vs),
+	KAP_VAR(air_vs),
+	KAP_VAR(elev_trim),
+	KAP_VAR(alt_disp),
+	KAP_VAR(air_alt),
+	KAP_VAR(baro_hpa),
+	KAP_VAR(baro_inhg),
+};
+
+#define KAP_VARS	(sizeof(kap_vars) / sizeof(kap_vars[0]))
+
+/*
+ * Line n of the state, for the console. Returns 0 past the end.
+ */
+uint8_t kap_state_line(uint8_t n, char *buf, uint8_t size)
+{
+	kap_var_t v;
+	int32_t val;
+
+	if (n >= KAP_VARS)
+		return 0;
+	memcpy_P(&v, &kap_vars[n], sizeof(v));
+
+	if (v.v_size == 1)
+		val = *(volatile uint8_t *)v.v_ptr;
+	else if (v.v_size == 2)
+		val = *(volatile int16_t *)v.v_ptr;
+	else
+		val = *(volatile int32_t *)v.v_ptr;
+
+	snprintf_P(buf, size, PSTR("%-14s %ld (0x%lx)\n\r"), v.v_name, val, val);
+	return 1;
+}
+
+/*
+ * Set the named state, returns 0 if there's no such thing
+ */
+uint8_t kap_state_set(const char *name, int32_t value)
+{
+	kap_var_t v;
+	uint8_t i;
+
+	for (i = 0; i < KAP_VARS; i++) {
+		memcpy_P(&v, &kap_vars[i], sizeof(v));
+
+		if (strcmp(name, v.v_name))
+			continue;
+
+		if (v.v_size == 1)
+			*(volatile uint8_t *)v.v_ptr = value;
+		else if (v.v_size == 2)
+			*(volatile int16_t *)v.v_ptr = value;
+		else
+			*(volatile int32_t *)v.v_ptr = value;
+		return 1;
+	}
+	return 0;
+}
+
 static void kap_lcd_pgm_udcs(uint8_t start, uint8_t num)
 {
 	uint8_t i;
@@ -1753,16 +1813,24 @@ void kap_init()
 	lcd_clrscr();
 	kap_lcd_pgm_udcs(0, 7);
 
-	kap_alt_fs_blk =		fsbus_register(KAP_ALT_CID, 		FS_CTRL_DISPLAY, kap_rcv_alt);
-	kap_vs_fs_blk =			fsbus_register(KAP_VS_CID, 			FS_CTRL_DISPLAY, kap_rcv_vs);
-	kap_baro_hpa_fs_blk =	fsbus_register(KAP_BARO_HPA_CID,	FS_CTRL_DISPLAY, kap_rcv_baro_hpa);
-	kap_baro_inhg_fs_blk =	fsbus_register(KAP_BARO_INHG_CID, 	FS_CTRL_DISPLAY, kap_rcv_baro_inhg);
-	kap_air_alt_fs_blk = 	fsbus_register(KAP_AIR_ALT_CID, 	FS_CTRL_DISPLAY, kap_rcv_air_alt);
+	kap_alt_fs_blk =		fsbus_register(KAP_ALT_CID, 		FS_CTRL_DISPLAY, NULL);
+	kap_vs_fs_blk =			fsbus_register(KAP_VS_CID, 			FS_CTRL_DISPLAY, NULL);
+	kap_baro_hpa_fs_blk =	fsbus_register(KAP_BARO_HPA_CID,	FS_CTRL_DISPLAY, NULL);
+	kap_baro_inhg_fs_blk =	fsbus_register(KAP_BARO_INHG_CID, 	FS_CTRL_DISPLAY, NULL);
+	kap_air_alt_fs_blk = 	fsbus_register(KAP_AIR_ALT_CID, 	FS_CTRL_DISPLAY, NULL);
 	kap_dio_blk = 			fsbus_register(KAP_DIO_CID, 		FS_CTRL_DIO, 	 kap_rcv_dio);
-	kap_elev_trim_blk =		fsbus_register(KAP_ELEV_TRIM_CID,	FS_CTRL_DISPLAY, kap_rcv_elev_trim);
-	kap_air_vs_blk =		fsbus_register(KAP_AIR_VS_CID,		FS_CTRL_DISPLAY, kap_rcv_air_vs);
+	kap_elev_trim_blk =		fsbus_register(KAP_ELEV_TRIM_CID,	FS_CTRL_DISPLAY, NULL);
+	kap_air_vs_blk =		fsbus_register(KAP_AIR_VS_CID,		FS_CTRL_DISPLAY, NULL);
 
 	// Register the regular display updates
-	event_register(kap_display, EVENT_HZ / 8, 0);
-	event_register(kap_buttons, EVENT_HZ / 10, 0);
+	event_register(kap_display, 125, 0);
+
+#if LCD_SHADOW
+	// One slot times everything that blinks on the LCD
+	event_register_flags(lcd_blink_tick, LCD_BLINK_MS, 0, EVENT_PRIO_LOW);
+#endif
+
+	// The buttons are run whenever the switches see a change, ahead of the
+	// display since the AP disconnect comes this way
+	switches_notify(event_register_flags(kap_buttons, 0, 0, EVENT_PRIO_HIGH));
 }
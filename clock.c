@@ -4,16 +4,77 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#ifndef CLOCK_HOST
 #include <avr/io.h>
+#endif
 #include <stdint.h>
+#ifndef CLOCK_HOST
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
 
 #include "event.h"
+#include "uart.h"
+#include "clock.h"
 #include "switches.h"
-#include "soft_uart.h"
+#ifndef CLOCK_HOST
+#include "trace.h"
+#endif
+
+/*
+ * The 200Hz system tick comes from TIMER2 in CTC mode at clk/1024. A tick
+ * isn't a whole number of counts (78.125 at 16MHz), so the odd fraction is
+ * carried from tick to tick and every so often one is a count longer. The
+ * average rate is exact and the jitter is a single count.
+ */
+#define CLOCK_T2_RATE	(F_CPU / 1024)
+#define CLOCK_T2_TOP	(CLOCK_T2_RATE / CLOCK)		// whole counts per tick
+#define CLOCK_T2_FRAC	(CLOCK_T2_RATE % CLOCK)		// left over, in 1/CLOCK counts
+
+#if (CLOCK_T2_TOP > 255)
+#error A tick is too long for TIMER2 at clk/1024
+#endif
 
-#define CLOCK	200L		// clock 200Hz = 5msec
+#if defined(__AVR_ATmega128__)
+#define CLOCK_T2_OCR	OCR2
+#define CLOCK_T2_VECT	TIMER2_COMP_vect
+#else
+#define CLOCK_T2_OCR	OCR2A
+#define CLOCK_T2_VECT	TIMER2_COMPA_vect
+#endif
+
+static uint16_t clock_t2_frac;
+
+/*
+ * TIMER1 free runs at clk/8 to count CPU cycles, clock_cycles() takes the
+ * top 16 bits from here. Its compare channels are left to the soft UART.
+ */
+static volatile uint16_t clock_t1_overflows;
+
+/*
+ * What each interrupt costs, see clock_isr_account()
+ */
+volatile isr_stat_t clock_tick_stat;
+
+/*
+ * Idle accounting. clock_idle() adds up the TIMER1 counts fsbus_main() spends
+ * asleep, and the clock interrupt latches the totals once a second. Sampling
+ * at the tick instead would always find it asleep, since the tick is what
+ * sets the callbacks off.
+ */
+static volatile uint16_t clock_wakeups;
+static volatile uint32_t clock_sleep_counts;
+static uint8_t clock_second = CLOCK;
+
+volatile uint16_t clock_wakeups_per_sec;
+volatile uint8_t clock_idle_pct;
+
+/*
+ * Ticks since clock_init(), the time base for the event scheduler. 32 bits
+ * at 200Hz wraps after about 248 days.
+ */
+static volatile uint32_t clock_ticks;
 
 void clock_isr(void);
 
@@ -24,50 +85,143 @@ void clock_isr(void);
 void clock_init(void)
 {
 
-	printf("clock_init()\n\r");
-
-
-	TCCR1A = 0;							// ctc, all pins normal
-	TCCR1B = _BV(CS10) | _BV(WGM12);	// ctc, no prescaler
-
-	OCR1A = (F_CPU / (SOFT_BAUD_RATE * 4)) - 1;
-
-	/*
+	trace_info(INIT, "clock_init()\n\r");
 
-    // use CLK/8 prescale value, clear timer/counter on compareA match                               
-	TCCR1B =  _BV(CS11)  | _BV(WGM12);
-    
-    // preset timer1 high/low byte
-    OCR1A = ((F_CPU/8/CLOCK) - 1 );   
-*/
+	// TIMER1, the cycle counter. Normal mode, clk/8
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);
+	CLOCK_T1_TIMSK |= _BV(TOIE1);
 
-    // enable Output Compare 1 overflow interrupt
+	// TIMER2, the system tick. CTC, clk/1024
+	clock_t2_frac = 0;
+	CLOCK_T2_OCR = CLOCK_T2_TOP - 1;
 #if defined(__AVR_ATmega128__)
-    TIMSK  |= _BV(OCIE1A);
+	TCCR2 = _BV(WGM21) | _BV(CS22) | _BV(CS20);
+	TIMSK |= _BV(OCIE2);
 #elif defined(__AVR_ATmega644__)
-	TIMSK1  |= _BV(OCIE1A);
+	TCCR2A = _BV(WGM21);
+	TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);
+	TIMSK2 |= _BV(OCIE2A);
 #endif
 
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
 	/* Register the switch reading routine */
-	printf("clock_init() - exit\n\r");
+	trace_debug(INIT, "clock_init() - exit\n\r");
 }
 
-static uint8_t ev_ticks = CLOCK/EVENT_HZ;
+ISR(CLOCK_T2_VECT)
+{
+	uint16_t start = TCNT1;
+
+	// Make this tick a count longer if the fractions have added up to one
+	clock_t2_frac += CLOCK_T2_FRAC;
+	if (clock_t2_frac >= CLOCK) {
+		clock_t2_frac -= CLOCK;
+		CLOCK_T2_OCR = CLOCK_T2_TOP;
+	} else {
+		CLOCK_T2_OCR = CLOCK_T2_TOP - 1;
+	}
 
-ISR(TIMER1_COMPA_vect)
+	clock_isr();
+
+	clock_isr_account(&clock_tick_stat, start);
+}
+
+ISR(TIMER1_OVF_vect)
 {
-	static uint16_t clock = 0;
+	clock_t1_overflows++;
+}
 
-	clock++;
-	soft_uart_isr();
+/*
+ * Add the time since start (a TCNT1 reading) to an interrupt's figures.
+ * Called at the end of an interrupt handler.
+ */
+void clock_isr_account(volatile isr_stat_t *s, uint16_t start)
+{
+	uint32_t t = (uint32_t)(uint16_t)(TCNT1 - start) * 8;
+
+	s->is_count++;
+	s->is_total += t;
+	if (t > s->is_max)
+		s->is_max = t;
+}
+
+/*
+ * A free running count of CPU cycles (to 8 cycles), from TIMER1 and its
+ * overflows. Wraps after 2^32 cycles (about 4.5 minutes at 16MHz), so use it
+ * for differences only.
+ */
+uint32_t clock_cycles(void)
+{
+	uint16_t hi, lo;
+	uint8_t sreg;
 
-	if (clock == ((SOFT_BAUD_RATE * 4) / CLOCK)) {
-		clock = 0;
-		clock_isr();
+	sreg = SREG;
+	cli();
+	hi = clock_t1_overflows;
+	lo = TCNT1;
+	if ((CLOCK_T1_TIFR & _BV(TOV1)) && lo < 0x8000) {
+		// TIMER1 has just wrapped and the interrupt hasn't run yet
+		hi++;
 	}
+	SREG = sreg;
+
+	return (((uint32_t)hi << 16) | lo) * 8;
+}
+
+/*
+ * Ticks since start up
+ */
+uint32_t clock_now(void)
+{
+	uint32_t t;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	t = clock_ticks;
+	SREG = sreg;
+
+	return t;
+}
+
+/*
+ * Milliseconds since start up, to the resolution of a tick. Wraps after about
+ * 49 days.
+ */
+uint32_t clock_now_ms(void)
+{
+	return clock_now() * CLOCK_MS;
 }
 
+/*
+ * Sleep until the next interrupt, unless there is already something for the
+ * main loop to do. Any interrupt will wake us: a received FSBUS byte, the
+ * clock tick (which is also when the next event can become due) or the soft
+ * UART.
+ */
+void clock_idle(void)
+{
+	uint16_t start;
+
+	cli();
+	if (event_pending() || uart_available()) {
+		sei();
+		return;
+	}
+	start = TCNT1;
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
 
+	// The interrupt that woke us has run by now and is counted in too
+	cli();
+	clock_sleep_counts += (uint16_t)(TCNT1 - start);
+	clock_wakeups++;
+	sei();
+}
 
 void clock_isr(void)
 {
@@ -77,21 +231,26 @@ void clock_isr(void)
 	 *   1. Key debouncing
 	 *   2. Our event infrastructure
 	 *
-	 * Why aren't we dealing with these the same way? Well the event
-	 * overhead isn't tiny and the keyboard interrupts are needed every 5ms.
-	 * So the answer is performance
+	 * Both run every 5ms tick. They are short, event_tick() only queues what
+	 * is due and the callbacks run from fsbus_main(). This runs with
+	 * interrupts off, so clock_tick_stat.is_max is also the longest the
+	 * soft UART interrupt can be held up by it.
 	 */
 
+	// Idle accounting
+	clock_second--;
+	if (clock_second == 0) {
+		clock_second = CLOCK;
+		clock_wakeups_per_sec = clock_wakeups;
+		clock_wakeups = 0;
+		clock_idle_pct = clock_sleep_counts / (F_CPU / 8 / 100);
+		clock_sleep_counts = 0;
+	}
+
 	// Key debouncing
 	switches_tick();
 
-	sei();
-
 	// Now the event handler
-	ev_ticks--;
-
-	if (ev_ticks == 0) {
-		ev_ticks = CLOCK/EVENT_HZ;
-		event_tick();
-	}
+	clock_ticks++;
+	event_tick(clock_ticks);
 }
@@ -1,6 +1,39 @@
 #ifndef _CLOCK_H_
 #define  _CLOCK_H_
 
+#define CLOCK		200L			// clock 200Hz = 5msec
+#define CLOCK_MS	(1000 / CLOCK)	// msec per tick
+
+/*
+ * TIMER1 free runs at clk/8 for clock_cycles(), other users may only take
+ * its compare channels
+ */
+#if defined(__AVR_ATmega128__)
+#define CLOCK_T1_TIMSK	TIMSK
+#define CLOCK_T1_TIFR	TIFR
+#else
+#define CLOCK_T1_TIMSK	TIMSK1
+#define CLOCK_T1_TIFR	TIFR1
+#endif
+
+/*
+ * Interrupt handler costs, in CPU cycles
+ */
+typedef struct isr_stat_s {
+	uint16_t	is_count;
+	uint32_t	is_max;
+	uint32_t	is_total;		// For the mean, is_total / is_count
+} isr_stat_t;
+
 void clock_init(void);
+void clock_idle(void);
+uint32_t clock_cycles(void);
+uint32_t clock_now(void);
+uint32_t clock_now_ms(void);
+void clock_isr_account(volatile isr_stat_t *s, uint16_t start);
+
+extern volatile uint16_t clock_wakeups_per_sec;	// CPU wakeups from idle over the last second
+extern volatile uint8_t clock_idle_pct;			// Percentage of the last second spent asleep
+extern volatile isr_stat_t clock_tick_stat;		// The system tick interrupt
 
 #endif
@@ -0,0 +1,228 @@
+/*
+ * Drive clock_isr() and event_run() on a simulated CPU, sleeping in
+ * clock_idle() as fsbus_main() does, and print the wakeups per second and
+ * idle percentage that clock.c latches for the console "stats". This is a
+ * host program, not part of the firmware, it builds clock.c, event.c and
+ * switches.c with the AVR parts stubbed out:
+ *
+ *	cc -std=gnu99 -O2 -o clock_idle_model clock_idle_model.c
+ *	clock_idle_model [rx bytes/s [load cycles ...]]
+ *
+ * The CPU runs at 16MHz. Interrupts take no time here. Three things wake
+ * the CPU:
+ *	- the 200Hz tick, which calls clock_isr();
+ *	- the TIMER1 overflow behind clock_cycles(), about 30 times a second;
+ *	- an FSBUS byte, [rx bytes/s] (300 by default) of them evenly spaced.
+ * The main loop is fsbus_main() less the LCD. Each received byte costs
+ * RCV_CYCLES in place of fsbus_rcv(). A normal priority callback burns
+ * [load cycles] every tick. Each load given (0, 8000, 40000 and 72000 by
+ * default) is run for MODEL_SECONDS.
+ *
+ * The means of the figures clock.c latches each second are printed, and
+ * beside them the time the model actually spent asleep.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define F_CPU			16000000UL
+#define RAMEND			0x10FF
+#define CLOCK_HOST
+#define EVENT_HOST
+#define SWITCHES_HOST
+#define FR_HOST
+
+#define _BV(b)					(1 << (b))
+#define ISR(v)					void v(void)
+#define PSTR(s)					(s)
+#define printf_P				printf
+#define snprintf_P				snprintf
+#define cli()					do { } while (0)
+#define sei()					do { } while (0)
+#define fr_log(id, arg, data)	do { } while (0)
+#define trace_info(mod, fmt, ...)	do { } while (0)
+#define trace_debug(mod, fmt, ...)	do { } while (0)
+
+/* Just the registers and sleep calls clock.c and switches.c use */
+#define CS11			1
+#define TOIE1			0
+#define TOV1			0
+#define OCR2A			model_ocr2a
+#define PINB0			0
+#define PINB1			1
+#define PINA			0xFF
+#define PINB			0xFF
+#define SLEEP_MODE_IDLE	0
+#define set_sleep_mode(m)	do { } while (0)
+#define sleep_enable()		do { } while (0)
+#define sleep_disable()		do { } while (0)
+#define sleep_cpu()			model_sleep()
+
+static uint8_t SREG, TCCR1A, TCCR1B, TIMSK1, TIFR1, model_ocr2a;
+uint8_t DDRA, PORTA, DDRB, PORTB;		// Not static, switches_init() is inline
+
+static uint32_t model_cycles;			/* Simulated time */
+#define TCNT1			((uint16_t)(model_cycles / 8))
+
+static void model_sleep(void);
+
+#include "event.c"
+#include "clock.c"
+#include "switches.c"
+
+#define MODEL_SECONDS	20
+#define RCV_CYCLES		300			// fsbus_rcv() of a byte
+#define TICK_CYCLES		(F_CPU / CLOCK)
+#define T1_CYCLES		(0x10000UL * 8)
+
+static uint32_t model_tick_at;		/* model_cycles of the next tick */
+static uint32_t model_t1_at;		/* of the next TIMER1 overflow */
+static uint32_t model_rx_at;		/* of the next FSBUS byte */
+static uint32_t model_rx_cycles;	/* Between FSBUS bytes, 0 for none */
+static uint16_t model_rx;			/* Bytes waiting for uart_getc() */
+static uint32_t model_load;
+static uint64_t model_asleep;		/* Cycles spent in sleep_cpu() */
+
+unsigned char uart_available(void)
+{
+	return model_rx != 0;
+}
+
+unsigned int uart_getc(void)
+{
+	if (!model_rx)
+		return UART_NO_DATA;
+	model_rx--;
+	return 0;
+}
+
+/*
+ * Cycles to the next interrupt
+ */
+static uint32_t model_next(void)
+{
+	uint32_t next = model_tick_at - model_cycles;
+
+	if (model_t1_at - model_cycles < next)
+		next = model_t1_at - model_cycles;
+	if (model_rx_cycles && model_rx_at - model_cycles < next)
+		next = model_rx_at - model_cycles;
+	return next;
+}
+
+/*
+ * Take the interrupts due now
+ */
+static void model_irq(void)
+{
+	if (model_cycles == model_t1_at) {
+		model_t1_at += T1_CYCLES;
+		TIMER1_OVF_vect();
+	}
+	if (model_rx_cycles && model_cycles == model_rx_at) {
+		model_rx_at += model_rx_cycles;
+		model_rx++;
+	}
+	if (model_cycles == model_tick_at) {
+		model_tick_at += TICK_CYCLES;
+		CLOCK_T2_VECT();
+	}
+}
+
+/*
+ * Let n cycles go by, taking the interrupts that come due meanwhile
+ */
+static void model_burn(uint32_t n)
+{
+	uint32_t next;
+
+	while (n) {
+		next = model_next();
+		if (n < next) {
+			model_cycles += n;
+			return;
+		}
+		model_cycles += next;
+		n -= next;
+		model_irq();
+	}
+}
+
+/*
+ * Asleep until the next interrupt
+ */
+static void model_sleep(void)
+{
+	uint32_t next = model_next();
+
+	model_cycles += next;
+	model_asleep += next;
+	model_irq();
+}
+
+static void model_load_run(__attribute__((unused)) uint32_t t)
+{
+	model_burn(model_load);
+}
+
+static void model_run(uint32_t load)
+{
+	uint32_t second = clock_ticks / CLOCK, seconds = 0, wakeups = 0, idle = 0;
+	uint64_t start;
+
+	event_init();
+	tick = clock_ticks;
+	model_load = load;
+	if (load)
+		event_register(model_load_run, CLOCK_MS, 0);
+
+	/* Skip the second under way, clock.c latches on whole ones */
+	while (clock_ticks / CLOCK == second)
+		model_burn(model_next());
+	second = clock_ticks / CLOCK;
+	start = model_asleep;
+
+	/* fsbus_main() */
+	while (seconds < MODEL_SECONDS) {
+		event_run();
+		if (uart_getc() & UART_NO_DATA)
+			clock_idle();
+		else
+			model_burn(RCV_CYCLES);
+
+		if (clock_ticks / CLOCK != second) {
+			second = clock_ticks / CLOCK;
+			seconds++;
+			wakeups += clock_wakeups_per_sec;
+			idle += clock_idle_pct;
+		}
+	}
+
+	printf("%11u %5.1f %11.1f %9.1f %9.1f\n", load, 100.0 * load / TICK_CYCLES,
+		(double)wakeups / seconds, (double)idle / seconds,
+		100.0 * (model_asleep - start) / ((double)seconds * F_CPU));
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t loads[] = { 0, 8000, 40000, 72000 };
+	uint32_t rx = argc > 1 ? atol(argv[1]) : 300;
+	int i;
+
+	model_rx_cycles = rx ? F_CPU / rx : 0;
+	model_tick_at = TICK_CYCLES;
+	model_t1_at = T1_CYCLES;
+	model_rx_at = model_rx_cycles;
+	clock_init();
+
+	printf("%u FSBUS bytes/s, means over %u seconds\n", rx, MODEL_SECONDS);
+	printf("load cycles  load  wakeups/s  idle pct  asleep %%\n");
+	if (argc > 2) {
+		for (i = 2; i < argc; i++)
+			model_run(atol(argv[i]));
+	} else {
+		for (i = 0; i < (int)(sizeof(loads) / sizeof(loads[0])); i++)
+			model_run(loads[i]);
+	}
+	return 0;
+}
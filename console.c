@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+
+#include "event.h"
+#include "clock.h"
+#include "soft_uart.h"
+#include "kap.h"
+#include "pid.h"
+#include "fsbus.h"
+#include "trace.h"
+#include "fr.h"
+#include "lcd.h"
+#include "console.h"
+
+/*
+ * A command line on the soft UART, for looking at and changing things while
+ * the firmware runs. Bytes come in from the soft UART receive interrupt and
+ * are dealt with by a low priority event, so typing never gets in the way of
+ * the autopilot.
+ *
+ * Nothing here waits on the soft UART. The echo and the prompt go out with
+ * trace_P(), whole or not at all. A command's output is made a line at a
+ * time by console_line_t sources and sent by the console_out event, one line
+ * a run through soft_uart_write(), trying again next tick while there's no
+ * room. Further commands wait until it has all gone.
+ */
+
+#define CONSOLE_LINE	32		// longest command line
+#define CONSOLE_ARGS	4		// most words in a command
+#define CONSOLE_OUT		64		// longest output line, the rest is cut off
+#define CONSOLE_SRCS	2		// most sources for one command
+
+static FILE console_str = FDEV_SETUP_STREAM(soft_uart_putchar, NULL, _FDEV_SETUP_WRITE);
+
+static char console_line[CONSOLE_LINE];
+static uint8_t console_len;
+
+/*
+ * Output in progress: the sources still to go, the line of the first that's
+ * next, and that line if soft_uart_write() had no room for it
+ */
+static console_line_t console_src[CONSOLE_SRCS];
+static uint8_t console_srcs;
+static uint8_t console_n;
+static char console_buf[CONSOLE_OUT];
+static uint8_t console_buf_len;
+static event_handle console_out_h;
+
+static void console_rx(void);
+
+/*
+ * Send the next line of output. Runs again on the next tick until there is
+ * none left, then prompts and takes any input that came meanwhile.
+ */
+static void console_out(void)
+{
+	while (!console_buf_len && console_srcs) {
+		if ((*console_src[0])(console_n, console_buf, sizeof(console_buf))) {
+			console_n++;
+			console_buf_len = strlen(console_buf);	// 0 for a line with nothing on it
+		} else {
+			/* On to the next source */
+			memmove(&console_src[0], &console_src[1], --console_srcs * sizeof(console_src[0]));
+			console_n = 0;
+		}
+	}
+
+	if (console_buf_len) {
+		if (soft_uart_write(console_buf, console_buf_len))
+			console_buf_len = 0;
+		event_schedule(console_out_h, 0);
+		return;
+	}
+
+	trace_P(PSTR("> "));
+	console_rx();
+}
+
+/*
+ * Add a source to the output for this command
+ */
+static void console_page(console_line_t src)
+{
+	if (console_srcs == CONSOLE_SRCS)
+		return;
+	if (!console_srcs) {
+		console_n = 0;
+		event_schedule(console_out_h, 0);
+	}
+	console_src[console_srcs++] = src;
+}
+
+static void console_isr_stat(char *buf, uint8_t size, PGM_P name, volatile isr_stat_t *s)
+{
+	isr_stat_t st;
+
+	cli();
+	st = *s;
+	sei();
+
+	snprintf_P(buf, size, PSTR("%S %5u %10lu %10lu\n\r"), name, st.is_count, st.is_max,
+		st.is_count ? st.is_total / st.is_count : 0);
+}
+
+static void console_isr_reset(volatile isr_stat_t *s)
+{
+	cli();
+	s->is_count = 0;
+	s->is_max = 0;
+	s->is_total = 0;
+	sei();
+}
+
+static uint8_t console_stats_line(uint8_t n, char *buf, uint8_t size)
+{
+	fsbus_block_t *blk;
+	uint8_t cid;
+
+	switch (n) {
+	case 0:
+		snprintf_P(buf, size, PSTR("idle %u%%, %u wakeups/s\n\r"), clock_idle_pct, clock_wakeups_per_sec);
+		return 1;
+	case 1:
+		snprintf_P(buf, size, PSTR("isr       count        max       mean\n\r"));
+		return 1;
+	case 2:
+		console_isr_stat(buf, size, PSTR("tick     "), &clock_tick_stat);
+		return 1;
+	case 3:
+		console_isr_stat(buf, size, PSTR("soft uart"), &soft_uart_stat);
+		return 1;
+	case 4:
+		snprintf_P(buf, size, PSTR("soft uart rx errors %u, trace lines dropped %u\n\r"),
+			soft_uart_rx_errors, trace_dropped);
+		return 1;
+	case 5:
+		snprintf_P(buf, size, PSTR("fsbus framing %u, overrun %u, unknown %u\n\r"),
+			fsbus_errors.fe_framing, fsbus_errors.fe_overrun, fsbus_errors.fe_unknown);
+		return 1;
+	case 6:
+#if LCD_ASYNC
+		snprintf_P(buf, size, PSTR("lcd writes %lu, queue max %u, full %u\n\r"),
+			lcd_writes, lcd_stat.ls_depth_max, lcd_stat.ls_full);
+#else
+		snprintf_P(buf, size, PSTR("lcd writes %lu\n\r"), lcd_writes);
+#endif
+		return 1;
+	case 7:
+		buf[0] = '\0';
+#if LCD_ASYNC
+		snprintf_P(buf, size, PSTR("lcd drain %uus max %uus\n\r"), lcd_stat.ls_drain, lcd_stat.ls_drain_max);
+#endif
+		return 1;
+	}
+
+	/* Then a line for each display */
+	n -= 8;
+	for (cid = 1; cid < FS_CID_MAX; cid++) {
+		blk = fs_get_blk(cid);
+		if (blk && blk->fs_ctrl_type == FS_CTRL_DISPLAY && !n--) {
+			snprintf_P(buf, size, PSTR("display %2u: %u repeats\n\r"), cid, blk->fs_display.fs_suppressed);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static const char console_help[] PROGMEM =
+	"stats               counters and timings\n\r"
+	"reset               zero the timings\n\r"
+	"trace [mask]        show or set the trace categories\n\r"
+	"kap [name value]    show or set the KAP140 state\n\r"
+	"pid [p i d]         show or set the VS PID gains (PID compiled out)\n\r"
+	"fr                  print the flight recorder, for fr_decode\n\r";
+
+static uint8_t console_help_line(uint8_t n, char *buf, uint8_t size)
+{
+	PGM_P p = console_help;
+	uint8_t i = 0;
+	char c;
+
+	/* Skip to the start of line n */
+	while (n) {
+		c = pgm_read_byte(p++);
+		if (!c)
+			return 0;
+		if (c == '\r')
+			n--;
+	}
+
+	while (i < size - 1 && (c = pgm_read_byte(p++))) {
+		buf[i++] = c;
+		if (c == '\r')
+			break;
+	}
+	buf[i] = '\0';
+	return i != 0;
+}
+
+static uint8_t console_trace_line(uint8_t n, char *buf, uint8_t size)
+{
+	if (n == 0)
+		snprintf_P(buf, size, PSTR("trace 0x%02x: kap %02x fsbus %02x display %02x init %02x\n\r"),
+			trace_mask, TRACE_KAP, TRACE_FSBUS, TRACE_DISPLAY, TRACE_INIT);
+	else if (n == 1)
+		snprintf_P(buf, size, PSTR("built to level kap %d, fsbus %d, display %d, init %d\n\r"),
+			TRACE_LEVEL_KAP, TRACE_LEVEL_FSBUS, TRACE_LEVEL_DISPLAY, TRACE_LEVEL_INIT);
+	else
+		return 0;
+	return 1;
+}
+
+static uint8_t console_pid_line(uint8_t n, char *buf, uint8_t size)
+{
+	int16_t p, i, d;
+
+	if (n)
+		return 0;
+	kap_pid_get(&p, &i, &d);
+	snprintf_P(buf, size, PSTR("p %d i %d d %d (x%d), PID compiled out\n\r"), p, i, d, SCALING_FACTOR);
+	return 1;
+}
+
+static void console_cmd(uint8_t argc, char **argv)
+{
+	fsbus_block_t *blk;
+	uint8_t cid;
+
+	if (!strcmp_P(argv[0], PSTR("stats"))) {
+#if EVENT_PROFILE
+		console_page(event_prof_line);
+#endif
+		console_page(console_stats_line);
+
+	} else if (!strcmp_P(argv[0], PSTR("reset"))) {
+#if EVENT_PROFILE
+		event_prof_reset();
+#endif
+		console_isr_reset(&clock_tick_stat);
+		console_isr_reset(&soft_uart_stat);
+		trace_dropped = 0;
+		fsbus_errors.fe_framing = 0;
+		fsbus_errors.fe_overrun = 0;
+		fsbus_errors.fe_unknown = 0;
+		lcd_writes = 0;
+#if LCD_ASYNC
+		cli();
+		lcd_stat.ls_depth_max = 0;
+		lcd_stat.ls_full = 0;
+		lcd_stat.ls_drain = 0;
+		lcd_stat.ls_drain_max = 0;
+		sei();
+#endif
+		for (cid = 1; cid < FS_CID_MAX; cid++) {
+			blk = fs_get_blk(cid);
+			if (blk && blk->fs_ctrl_type == FS_CTRL_DISPLAY)
+				blk->fs_display.fs_suppressed = 0;
+		}
+
+	} else if (!strcmp_P(argv[0], PSTR("trace"))) {
+		if (argc > 1)
+			trace_mask = strtoul(argv[1], NULL, 0);
+		console_page(console_trace_line);
+
+	} else if (!strcmp_P(argv[0], PSTR("kap"))) {
+		if (argc > 2 && !kap_state_set(argv[1], strtol(argv[2], NULL, 0)))
+			trace_P(PSTR("no %s\n\r"), argv[1]);
+		console_page(kap_state_line);
+
+	} else if (!strcmp_P(argv[0], PSTR("pid"))) {
+		if (argc > 3)
+			kap_pid_set(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+		console_page(console_pid_line);
+
+	} else if (!strcmp_P(argv[0], PSTR("fr"))) {
+#if (FR_SIZE > 0)
+		console_page(fr_line);
+#endif
+
+	} else {
+		console_page(console_help_line);
+	}
+}
+
+/*
+ * The event posted by the soft UART for each byte received. Input is left
+ * in the soft UART while a command's output is still going out.
+ */
+static void console_rx(void)
+{
+	unsigned int c;
+	char *argv[CONSOLE_ARGS];
+	uint8_t argc;
+
+	while (!console_srcs && !((c = soft_uart_getc()) & SOFT_UART_NO_DATA)) {
+		if (c == '\r') {
+			trace_P(PSTR("\n\r"));
+			console_line[console_len] = '\0';
+			console_len = 0;
+
+			argc = 0;
+			argv[0] = strtok(console_line, " ");
+			while (argv[argc] && ++argc < CONSOLE_ARGS)
+				argv[argc] = strtok(NULL, " ");
+
+			if (argc)
+				console_cmd(argc, argv);
+			if (!console_srcs)
+				trace_P(PSTR("> "));	// otherwise console_out() prompts when it's done
+
+		} else if (c == '\b' || c == 0x7f) {
+			if (console_len) {
+				console_len--;
+				trace_P(PSTR("\b \b"));
+			}
+
+		} else if (c >= ' ' && console_len < CONSOLE_LINE - 1) {
+			console_line[console_len++] = c;
+			trace_P(PSTR("%c"), c);
+		}
+	}
+}
+
+/*
+ * Send stdout to the soft UART and start listening for commands
+ */
+void console_init(void)
+{
+	stdout = stderr = &console_str;
+
+	console_len = 0;
+	console_srcs = 0;
+	console_buf_len = 0;
+	console_out_h = event_register_flags(console_out, 0, 0, EVENT_PRIO_LOW);
+	soft_uart_notify(event_register_flags(console_rx, 0, 0, EVENT_PRIO_LOW));
+
+	printf_P(PSTR("kap140 console, 'help' for commands\n\r> "));
+}
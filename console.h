@@ -0,0 +1,13 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+/*
+ * A source of console output. Puts line n, NUL terminated, in buf (size
+ * bytes) and returns 1, or returns 0 if there's no line n. A line may be
+ * left empty, it's then skipped.
+ */
+typedef uint8_t (*console_line_t)(uint8_t n, char *buf, uint8_t size);
+
+void console_init(void);
+
+#endif
@@ -0,0 +1,33 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "event.h"
+#include "coroutine.h"
+
+/*
+ * Start (or restart from the top) a coroutine. It takes an event slot, which
+ * it keeps until it ends or is stopped, and first runs on the next tick.
+ * Returns 0 if there are no event slots free.
+ */
+uint8_t co_start(co_t *co, void (*func)())
+{
+	if (!co->co_h) {
+		co->co_h = event_register(func, 0, 0);
+		if (!co->co_h)
+			return 0;
+	}
+	co->co_lc = 0;
+	event_schedule(co->co_h, 0);
+
+	return 1;
+}
+
+/*
+ * Stop a coroutine wherever it is and give back its event slot
+ */
+void co_stop(co_t *co)
+{
+	if (co->co_h)
+		event_cancel(&co->co_h);
+	co->co_lc = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+/*
+ * Stackless coroutines on top of the event scheduler, in the style of
+ * protothreads. A timed sequence (blink for a while, then do something) can
+ * be written as straight line code, and holds a single event slot while it
+ * runs rather than one per step.
+ *
+ *	CO_THREAD(kap_thing)
+ *	{
+ *		CO_BEGIN(co);
+ *		lcd_puts("ON");
+ *		CO_DELAY(co, 500);
+ *		lcd_puts("  ");
+ *		CO_END(co);
+ *	}
+ *
+ *	CO_START(kap_thing);
+ *
+ * The body is a switch on the line it last stopped at, so locals don't
+ * survive a CO_DELAY() (use statics), there can only be one CO_DELAY() per
+ * line, and the body can't itself use a switch around a CO_DELAY().
+ * Everything runs from event_run() in the main loop.
+ */
+
+typedef struct co_s {
+	uint16_t		co_lc;		/* Line to resume at, 0 to start from the top */
+	event_handle	co_h;		/* Event slot while running, 0 if stopped */
+} co_t;
+
+#define CO_WAITING	0
+#define CO_ENDED	1
+
+/*
+ * Define a coroutine called name. This gives the co_t, the event callback
+ * that resumes it, and the head of the body, which follows in braces.
+ */
+#define CO_THREAD(name) \
+	static co_t name##_co; \
+	static uint8_t name##_body(co_t *co); \
+	static void name(void) \
+	{ \
+		if (name##_body(&name##_co) == CO_ENDED) \
+			co_stop(&name##_co); \
+	} \
+	static uint8_t name##_body(co_t *co)
+
+#define CO_BEGIN(co)	switch ((co)->co_lc) { case 0:
+
+#define CO_END(co)		} (co)->co_lc = 0; return CO_ENDED
+
+/*
+ * Give up the CPU and carry on ms msec from now
+ */
+#define CO_DELAY(co, ms) \
+	do { \
+		(co)->co_lc = __LINE__; \
+		event_schedule((co)->co_h, (ms)); \
+		return CO_WAITING; \
+		case __LINE__:; \
+	} while (0)
+
+#define CO_START(name)		co_start(&name##_co, name)
+#define CO_STOP(name)		co_stop(&name##_co)
+#define CO_RUNNING(name)	(name##_co.co_h != 0)
+
+extern uint8_t co_start(co_t *co, void (*func)());
+extern void co_stop(co_t *co);
+
+#endif
@@ -1,45 +1,233 @@
 #include <stdlib.h>
-#include <avr/io.h>
-//#include <stdio.h>
+#include <stdio.h>
 #include <stdint.h>
+#ifndef EVENT_HOST
+#include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <avr/interrupt.h>
+#endif
 
 #include "event.h"
+#include "clock.h"
+#include "fr.h"
 /*
  *
  *		1.	Provides a service, where you can register a function to be called every so
- *			many ticks
- *		2.	Another service where you register a function to be called so many ticks
+ *			many msec
+ *		2.	Another service where you register a function to be called so many msec
  *			from now.
  *
+ *	Times are kept in clock ticks (CLOCK_MS each) against the 32 bit clock_now()
+ *	count, so a period is exact to the tick.
+ *
  *	The event handle is the index + 1. This is so that the consumer can assume non null
  *  for a useful handle.
+ *
+ *	event_tick() runs from the timer interrupt and only works out what is due. The
+ *	due handles are pushed onto a ready queue and the callbacks are run from the
+ *	main loop by event_run(), so nothing slow ever happens in interrupt context.
  */
 
 static volatile event_t event_list[EVENT_MAX];
 
-static volatile uint16_t tick = 0;
+/*
+ * The timing wheel. Each slot holds a doubly linked list (by handle) of the
+ * events whose e_when hashes to it, so a tick only looks at one slot rather
+ * than at every registered event.
+ */
+#define EVENT_WHEEL_MASK (EVENT_WHEEL - 1)
+
+#if (EVENT_WHEEL & EVENT_WHEEL_MASK)
+#error EVENT_WHEEL is not a power of 2
+#endif
+
+#if (EVENT_MAX > 255)
+#error EVENT_MAX must fit in an event_handle
+#endif
+
+static volatile uint8_t event_wheel[EVENT_WHEEL];
+
+/*
+ * Unused slots are kept on a singly linked list through e_next
+ */
+static volatile uint8_t event_free;
+
+/*
+ * The ready queues, one per priority. Each is a single producer (event_tick)
+ * / single consumer (event_run) ring of handles, so neither side needs to
+ * lock the other out. Stale entries left behind by event_cancel() can share
+ * a ring with live ones, hence the slack over EVENT_MAX.
+ */
+#ifndef EVENT_READY_SIZE
+#define EVENT_READY_SIZE 16
+#endif
+#define EVENT_READY_MASK (EVENT_READY_SIZE - 1)
+
+#if (EVENT_READY_SIZE & EVENT_READY_MASK)
+#error EVENT_READY_SIZE is not a power of 2
+#endif
+
+#define EVENT_Q_HIGH	0
+#define EVENT_Q_NORMAL	1
+#define EVENT_Q_LOW		2
+
+/* Ready queue for an event's EF_PRIO bits */
+#define EVENT_Q(h)	((EV(h).e_flags & EF_PRIO) == EVENT_PRIO_HIGH ? EVENT_Q_HIGH : \
+					 (EV(h).e_flags & EF_PRIO) == EVENT_PRIO_LOW ? EVENT_Q_LOW : EVENT_Q_NORMAL)
+
+static volatile uint8_t event_ready[EVENT_PRIOS][EVENT_READY_SIZE];
+static volatile uint8_t event_ready_head[EVENT_PRIOS];
+static volatile uint8_t event_ready_tail[EVENT_PRIOS];
+
+/*
+ * CPU cycles the callbacks may use in one tick before low priority ones
+ * are held over to the next. Half a tick by default.
+ */
+#ifndef EVENT_BUDGET
+#define EVENT_BUDGET	(F_CPU / 1000 * CLOCK_MS / 2)
+#endif
+
+static uint32_t event_budget_tick;		/* Tick event_budget_used is for */
+static uint32_t event_budget_used;
 
-static uint8_t event_service = 0;
+static volatile uint32_t tick = 0;
 
-event_handle event_register(void (*func)(), uint8_t period, uint8_t occurrences)
+/*
+ * Deadlines that were coalesced or dropped, across all events
+ */
+volatile uint16_t event_missed = 0;
+
+#if EVENT_PROFILE
+static volatile event_prof_t event_prof[EVENT_PROF_MAX];
+static event_lat_t event_lat[EVENT_PRIOS];
+
+/*
+ * Find the profile entry for a callback, allocating one if it's new
+ */
+static uint8_t event_prof_find(void (*func)())
 {
 	uint8_t i;
 
+	for (i = 0; i < EVENT_PROF_MAX; i++) {
+		if (event_prof[i].p_func == func)
+			return i;
+		if (event_prof[i].p_func == NULL) {
+			event_prof[i].p_func = func;
+			event_prof[i].p_min = UINT32_MAX;
+			return i;
+		}
+	}
+	return EVENT_PROF_NONE;
+}
+#endif
+
+#define EV(h) event_list[(h) - 1]
+
+/*
+ * Put an event into the wheel slot for its e_when. Interrupts must be off.
+ */
+static void event_link(event_handle h)
+{
+	uint8_t s = EV(h).e_when & EVENT_WHEEL_MASK;
+
+	EV(h).e_prev = 0;
+	EV(h).e_next = event_wheel[s];
+	if (event_wheel[s])
+		EV(event_wheel[s]).e_prev = h;
+	event_wheel[s] = h;
+	EV(h).e_flags |= EF_LINKED;
+}
+
+/*
+ * Take an event out of its wheel slot. Interrupts must be off.
+ */
+static void event_unlink(event_handle h)
+{
+	if (EV(h).e_prev)
+		EV(EV(h).e_prev).e_next = EV(h).e_next;
+	else
+		event_wheel[EV(h).e_when & EVENT_WHEEL_MASK] = EV(h).e_next;
+
+	if (EV(h).e_next)
+		EV(EV(h).e_next).e_prev = EV(h).e_prev;
+
+	EV(h).e_flags &= ~EF_LINKED;
+}
+
+/*
+ * Put an event on the ready queue, unless it's already there. Only called
+ * from interrupt context, which is the single producer for the queue.
+ * Returns 0 if the queue is full.
+ */
+static uint8_t event_queue(event_handle h)
+{
+	uint8_t q, head;
+
+	if (EV(h).e_flags & EF_QUEUED)
+		return 1;
+
+	q = EVENT_Q(h);
+	head = (event_ready_head[q] + 1) & EVENT_READY_MASK;
+	if (head == event_ready_tail[q])
+		return 0;
+
+	event_ready[q][head] = h;
+	event_ready_head[q] = head;
+	EV(h).e_flags |= EF_QUEUED;
+#if EVENT_PROFILE
+	EV(h).e_queued = clock_cycles();
+#endif
+	return 1;
+}
+
+/*
+ * Return an event to the free list. Interrupts must be off.
+ */
+static void event_free_slot(event_handle h)
+{
+	EV(h).e_func = NULL;
+	EV(h).e_flags = 0;
+	EV(h).e_next = event_free;
+	event_free = h;
+}
+
+/*
+ * Register func to be called every ms msec, rounded up to a whole tick. A
+ * period of zero registers an event that is never scheduled, it only runs
+ * when given to event_post(). flags is EVENT_COALESCE or EVENT_CATCHUP,
+ * or'ed with an EVENT_PRIO_.
+ */
+event_handle event_register_flags(void (*func)(), uint16_t ms, uint8_t occurrences, uint8_t flags)
+{
+	event_handle h;
+	uint16_t period = (ms + CLOCK_MS - 1) / CLOCK_MS;
+
 //	printf("event_register()\n\r");
 	cli();
-	for (i = EVENT_MAX - 1; i > 0; i--) {
-		if (!event_list[i].e_func) {
-			event_list[i].e_func = func;
-			event_list[i].e_when = tick + period;
-			event_list[i].e_period = period;
-			event_list[i].e_occurrences = occurrences;
-			break;
-		}
+	h = event_free;
+	if (h) {
+		event_free = EV(h).e_next;
+
+		EV(h).e_func = func;
+		EV(h).e_when = tick + period;
+		EV(h).e_period = period;
+		EV(h).e_occurrences = occurrences;
+		EV(h).e_flags = flags & (EF_CATCHUP | EF_PRIO);
+		EV(h).e_pending = 0;
+#if EVENT_PROFILE
+		EV(h).e_prof = event_prof_find(func);
+#endif
+		if (period)
+			event_link(h);
 	}
 	sei();
-//	printf("event_register: regisitered func %p, handle %d\n\r", func, i);
-	return (event_handle) i + 1;
+//	printf("event_register: regisitered func %p, handle %d\n\r", func, h);
+	return h;
+}
+
+event_handle event_register(void (*func)(), uint16_t ms, uint8_t occurrences)
+{
+	return event_register_flags(func, ms, occurrences, EVENT_COALESCE);
 }
 
 /*
@@ -48,9 +236,32 @@ event_handle event_register(void (*func)(), uint8_t period, uint8_t occurrences)
  */
 void event_reset(event_handle h)
 {
-	h--;
 	cli();
-	event_list[h].e_when = tick + event_list[h].e_period;
+	if (h && EV(h).e_func && EV(h).e_period && !(EV(h).e_flags & EF_DONE)) {
+		if (EV(h).e_flags & EF_LINKED)
+			event_unlink(h);
+		EV(h).e_when = tick + EV(h).e_period;
+		event_link(h);
+	}
+	sei();
+}
+
+/*
+ * Make a registered event come due once, ms msec from now (rounded up to a
+ * whole tick, so at least the next tick). Its next periodic deadline, if it
+ * has a period, moves to then as well. Used by the coroutines to sleep.
+ */
+void event_schedule(event_handle h, uint16_t ms)
+{
+	uint16_t ticks = (ms + CLOCK_MS - 1) / CLOCK_MS;
+
+	cli();
+	if (h && EV(h).e_func && !(EV(h).e_flags & EF_DONE)) {
+		if (EV(h).e_flags & EF_LINKED)
+			event_unlink(h);
+		EV(h).e_when = tick + (ticks ? ticks : 1);
+		event_link(h);
+	}
 	sei();
 }
 
@@ -62,7 +273,11 @@ uint8_t event_cancel(volatile event_handle *h)
 //	printf("event_cancel(%d)\n\r", *h);
 	cli();
 	if (*h) {
-		event_list[(*h) - 1].e_func = NULL;
+		if (EV(*h).e_func) {
+			if (EV(*h).e_flags & EF_LINKED)
+				event_unlink(*h);
+			event_free_slot(*h);	/* Any queued run is dropped too */
+		}
 		*h = 0;
 	}
 	sei();
@@ -70,8 +285,8 @@ uint8_t event_cancel(volatile event_handle *h)
 }
 
 
-void inline
-event_init()
+inline void
+event_init(void)
 {
 	uint8_t i;
 /*
@@ -99,73 +314,334 @@ printf("event_init() - OCR2 = %d\n\r", (F_CPU / (2 * 1024 * EVENT_HZ)) - 1);
     TIMSK  |= _BV(OCIE2);
 */
 
+	event_free = 0;
 	for (i = EVENT_MAX; i > 0; i--) {
-		event_list[i - 1].e_func = NULL;
+		event_free_slot(i);
+	}
+
+	for (i = 0; i < EVENT_WHEEL; i++) {
+		event_wheel[i] = 0;
+	}
+
+	for (i = 0; i < EVENT_PRIOS; i++) {
+		event_ready_head[i] = 0;
+		event_ready_tail[i] = 0;
 	}
 }
 
 /*
- * Interrupt handler for our timer
+ * Count n deadlines that won't get a run of their own
  */
-//ISR(TIMER1_COMPA_vect)    // handler for Output Compare 1 overflow interrupt
-/*ISR(TIMER2_COMP_vect)*/
-void event_tick()
+static void event_miss(event_handle h, uint8_t n)
 {
-	uint8_t i;
-	void (*func)();
+	event_missed += n;
+#if EVENT_PROFILE
+	if (EV(h).e_prof != EVENT_PROF_NONE)
+		event_prof[EV(h).e_prof].p_misses += n;
+#endif
+}
 
-//static 	uint16_t	e_when = 0;			/* Time when this needs to happen */
-//static void		(*e_func)() = NULL;
+/*
+ * An event has come due. Queue it and put it back in the wheel for its next
+ * period, or mark it done if that was the last occurrence. Interrupts are off.
+ */
+static void event_fire(event_handle h, uint32_t now)
+{
+	uint32_t late;
+	uint8_t due, extra;
 
-	cli();
-	if (event_service) {
-		sei();
-		return;
+	event_unlink(h);
+
+	/*
+	 * Work out how many deadlines have gone by, normally just the one. The
+	 * next is kept in phase with the original schedule.
+	 */
+	due = 1;
+	if (EV(h).e_period) {
+		late = now - EV(h).e_when;
+		if (late >= EV(h).e_period) {
+			late /= EV(h).e_period;
+			due = late > 254 ? 255 : late + 1;
+			EV(h).e_when += late * EV(h).e_period;
+		}
+		EV(h).e_when += EV(h).e_period;
+	}
+
+	if (EV(h).e_occurrences) {
+		if (due >= EV(h).e_occurrences) {
+			/* This is the last time, event_run() frees the slot */
+			due = EV(h).e_occurrences;
+			EV(h).e_flags |= EF_DONE;
+		}
+		EV(h).e_occurrences -= due;
 	}
-	event_service = 1;
 
-	/* Do whatever needs to be done this tick */
-	tick++;
+	/* A run already on the ready queue doesn't count, it's for an earlier one */
+	extra = due;
+	if (!(EV(h).e_flags & EF_QUEUED)) {
+		if (event_queue(h)) {
+			extra--;
+		} else if (EV(h).e_flags & EF_DONE) {
+			event_miss(h, due);
+			event_free_slot(h);
+			return;
+		}
+	}
 
+	if (!(EV(h).e_flags & EF_QUEUED)) {
+		event_miss(h, extra);		/* Ready queue full */
+	} else if (EV(h).e_flags & EF_CATCHUP) {
+		if (extra > 255 - EV(h).e_pending) {
+			event_miss(h, extra - (255 - EV(h).e_pending));
+			EV(h).e_pending = 255;
+		} else {
+			EV(h).e_pending += extra;
+		}
+	} else {
+		event_miss(h, extra);
+	}
+
+	/* A one off from event_schedule() waits for the next one */
+	if (!(EV(h).e_flags & EF_DONE) && EV(h).e_period)
+		event_link(h);
+}
 
-	for (i = EVENT_MAX - 1; i > 0; i--) {
-		cli();
 /*
-		if (i == 3 && e_when != event_list[i].e_when)
-			printf("et: i = %d, f = %p, lw = %d, w = %d, tick = %d\n\r",
-				i, event_list[i].e_func, e_when, event_list[i].e_when, tick);
-*/
-		if (event_list[i].e_func && event_list[i].e_when == tick) {
+ * Called from the timer interrupt every tick with clock_now(). Works out
+ * which events are due and queues them for event_run(), it never calls them
+ * itself.
+ *
+ * If ticks were skipped every wheel slot passed over since the last call is
+ * looked at too, and anything overdue is fired rather than left to wait for
+ * the tick count to come round again.
+ */
+void event_tick(uint32_t now)
+{
+	uint8_t h, next, n;
+	uint32_t t;
 
-//			if (i == 3)
-//				e_when = event_list[i].e_when;
+	n = (now - tick) > EVENT_WHEEL ? EVENT_WHEEL : (uint8_t)(now - tick);
+	tick = now;
+
+	for (t = now - n + 1; n; n--, t++) {
+		for (h = event_wheel[t & EVENT_WHEEL_MASK]; h; h = next) {
+			next = EV(h).e_next;
+
+			if (EVENT_DUE(EV(h).e_when, now)) {
+				fr_log(FR_EVENT, h, now);
+				event_fire(h, now);
+			}
+			/* else due on a later turn of the wheel */
+		}
+	}
+}
 
-			func = event_list[i].e_func;
+/*
+ * Queue an event to run straight away, without waiting for its next tick.
+ * For interrupt handlers only, e.g. to hand a key press to the main loop.
+ */
+void event_post(event_handle h)
+{
+	if (h && EV(h).e_func && !(EV(h).e_flags & EF_DONE))
+		event_queue(h);
+}
 
-			if (event_list[i].e_occurrences) {
+/*
+ * Non zero if there are callbacks waiting for event_run()
+ */
+uint8_t event_pending()
+{
+	return event_ready_tail[EVENT_Q_HIGH] != event_ready_head[EVENT_Q_HIGH] ||
+		event_ready_tail[EVENT_Q_NORMAL] != event_ready_head[EVENT_Q_NORMAL] ||
+		(event_ready_tail[EVENT_Q_LOW] != event_ready_head[EVENT_Q_LOW] &&
+			(event_budget_used < EVENT_BUDGET || event_budget_tick != tick));
+}
 
-				event_list[i].e_occurrences--;
+/*
+ * Take the next handle off the highest priority ready queue with anything
+ * on it, 0 if there's nothing that can run now. Low priority work waits for
+ * the next tick once the budget has gone.
+ */
+static uint8_t event_next()
+{
+	uint8_t q, tail, h;
 
-				if (event_list[i].e_occurrences == 0) {
-					/* This is the last time */
-					event_list[i].e_func = NULL;
-				} else {
-					event_list[i].e_when = tick + event_list[i].e_period;
-				}
-			} else
-				event_list[i].e_when = tick + event_list[i].e_period;
+	for (q = EVENT_Q_HIGH; q < EVENT_PRIOS; q++) {
+		if (event_ready_tail[q] == event_ready_head[q])
+			continue;
 
-			sei();
-			(*func)(tick);
-		} else {
-//			if (i == 3)
-//				e_when = event_list[i].e_when;
+		if (q == EVENT_Q_LOW && event_budget_used >= EVENT_BUDGET) {
+#if EVENT_PROFILE
+			if (event_budget_used != UINT32_MAX) {
+				event_lat[q].l_deferred++;
+				event_budget_used = UINT32_MAX;	/* Only count once a tick */
+			}
+#endif
+			return 0;
 		}
-		sei();
+
+		tail = (event_ready_tail[q] + 1) & EVENT_READY_MASK;
+		h = event_ready[q][tail];
+		event_ready_tail[q] = tail;
+		return h;
 	}
+	return 0;
+}
+
+/*
+ * Run the callbacks queued by event_tick(), highest priority first. Called
+ * from the main loop.
+ */
+void event_run()
+{
+	uint8_t h, runs;
+	void (*func)();
+	uint32_t t;
+#if EVENT_PROFILE
+	uint8_t p, q;
+	volatile event_prof_t *pp;
+#endif
+
 	cli();
-	event_service = 0;
+	if (event_budget_tick != tick) {
+		/* New tick, new budget */
+		event_budget_tick = tick;
+		event_budget_used = 0;
+	}
 	sei();
+
+	while ((h = event_next())) {
+		cli();
+		if (!(EV(h).e_flags & EF_QUEUED)) {
+			/* Cancelled since it was queued */
+			sei();
+			continue;
+		}
+		func = EV(h).e_func;
+#if EVENT_PROFILE
+		p = EV(h).e_prof;
+		q = EVENT_Q(h);
+		t = clock_cycles() - EV(h).e_queued;
+#endif
+		runs = EV(h).e_pending;
+		EV(h).e_pending = 0;
+		EV(h).e_flags &= ~EF_QUEUED;
+		if (EV(h).e_flags & EF_DONE)
+			event_free_slot(h);
+		else
+			EV(h).e_flags |= EF_RUNNING;
+		sei();
+
+#if EVENT_PROFILE
+		event_lat[q].l_runs++;
+		event_lat[q].l_total += t;
+		if (t > event_lat[q].l_max)
+			event_lat[q].l_max = t;
+#endif
+
+		/* One run, plus any an EF_CATCHUP event fell behind by */
+		do {
+			t = clock_cycles();
+			(*func)(tick);
+			t = clock_cycles() - t;
+
+			if (event_budget_used < EVENT_BUDGET)
+				event_budget_used += t;
+#if EVENT_PROFILE
+			if (p != EVENT_PROF_NONE) {
+				pp = &event_prof[p];
+				pp->p_calls++;
+				pp->p_total += t;
+				if (t < pp->p_min)
+					pp->p_min = t;
+				if (t > pp->p_max)
+					pp->p_max = t;
+			}
+#endif
+		} while (runs--);
+
+		cli();
+		EV(h).e_flags &= ~EF_RUNNING;
+		sei();
+	}
 }
 
+#if EVENT_PROFILE
+/*
+ * Line n of the callback profile, for the console. Returns 0 past the end.
+ */
+uint8_t event_prof_line(uint8_t n, char *buf, uint8_t size)
+{
+	uint8_t used;
+	event_prof_t p;
+	event_lat_t l;
+
+	if (n == 0) {
+		snprintf_P(buf, size, PSTR("func   calls  miss        min        max       mean\n\r"));
+		return 1;
+	}
+	n--;
+
+	for (used = 0; used < EVENT_PROF_MAX && event_prof[used].p_func; used++)
+		;
+	if (n < used) {
+		cli();
+		p = event_prof[n];
+		sei();
 
+		if (p.p_calls == 0)
+			snprintf_P(buf, size, PSTR("%p %5u %5u          -          -          -\n\r"),
+				p.p_func, p.p_calls, p.p_misses);
+		else
+			snprintf_P(buf, size, PSTR("%p %5u %5u %10lu %10lu %10lu\n\r"), p.p_func, p.p_calls, p.p_misses,
+				(unsigned long)p.p_min, (unsigned long)p.p_max, (unsigned long)(p.p_total / p.p_calls));
+		return 1;
+	}
+	n -= used;
+
+	if (n == 0) {
+		snprintf_P(buf, size, PSTR("missed deadlines %u\n\r"), event_missed);
+		return 1;
+	}
+	if (n == 1) {
+		snprintf_P(buf, size, PSTR("prio   runs defer    max lat   mean lat\n\r"));
+		return 1;
+	}
+	n -= 2;
+
+	if (n < EVENT_PRIOS) {
+		cli();
+		l = event_lat[n];
+		sei();
+
+		snprintf_P(buf, size, PSTR("%-5s %5u %5u %10lu %10lu\n\r"), n == EVENT_Q_HIGH ? "high" : n == EVENT_Q_LOW ? "low" : "norm",
+			l.l_runs, l.l_deferred, (unsigned long)l.l_max, (unsigned long)(l.l_runs ? l.l_total / l.l_runs : 0));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Zero the figures, keeping the function to entry mapping
+ */
+void event_prof_reset()
+{
+	uint8_t i;
+
+	cli();
+	for (i = 0; i < EVENT_PROF_MAX; i++) {
+		event_prof[i].p_calls = 0;
+		event_prof[i].p_misses = 0;
+		event_prof[i].p_min = UINT32_MAX;
+		event_prof[i].p_max = 0;
+		event_prof[i].p_total = 0;
+	}
+	for (i = 0; i < EVENT_PRIOS; i++) {
+		event_lat[i].l_runs = 0;
+		event_lat[i].l_deferred = 0;
+		event_lat[i].l_max = 0;
+		event_lat[i].l_total = 0;
+	}
+	sei();
+}
+#endif
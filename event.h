@@ -1,21 +1,121 @@
 #ifndef _EVENT_H_
 #define _EVENT_H_
 
-#define EVENT_HZ       10     // frequency in 1Hz
+#ifndef EVENT_MAX
 #define EVENT_MAX 10
+#endif
+
+/*
+ * With EVENT_PROFILE set every callback is timed, see event_prof_line().
+ * Each distinct callback function takes one of EVENT_PROF_MAX entries.
+ */
+#ifndef EVENT_PROFILE
+#define EVENT_PROFILE 1		/* 0: no profile, 1: time the callbacks */
+#endif
+
+#ifndef EVENT_PROF_MAX
+#define EVENT_PROF_MAX 12
+#endif
+
+/*
+ * Number of slots in the timing wheel, must be a power of 2. Events due more
+ * than EVENT_WHEEL ticks away stay in their slot and are skipped over until
+ * the wheel comes round to them again.
+ */
+#ifndef EVENT_WHEEL
+#define EVENT_WHEEL 32
+#endif
 
 typedef struct event_s {
-	uint16_t	e_when;			/* Time when this needs to happen */
-	uint8_t		e_period;		/* Periodicity (ticks) */
+	uint32_t	e_when;			/* Tick when this needs to happen, see clock_now() */
+	uint16_t	e_period;		/* Periodicity (ticks, rounded up from msec) */
 	uint8_t		e_occurrences;	/* Number of times (zero means forever) */
+	uint8_t		e_next;			/* Next handle in the same wheel slot (or free list), 0 ends the list */
+	uint8_t		e_prev;			/* Previous handle in the same wheel slot, 0 if first */
+	uint8_t		e_flags;		/* EF_ flags below */
+	uint8_t		e_pending;		/* EF_CATCHUP runs owed on top of the queued one */
+#if EVENT_PROFILE
+	uint32_t	e_queued;		/* clock_cycles() when put on the ready queue */
+	uint8_t		e_prof;			/* Index into the profile table, EVENT_PROF_NONE if full */
+#endif
 	void		(*e_func)();	/* Function to call - NULL indicates a free slot*/
 } event_t;
 
+#define EF_QUEUED	0x01		/* On the ready queue waiting for event_run() */
+#define EF_DONE		0x02		/* Last occurrence, out of the wheel and freed once run */
+#define EF_RUNNING	0x04		/* Callback is running now */
+#define EF_LINKED	0x08		/* In the timing wheel */
+#define EF_CATCHUP	0x10		/* Run once for every deadline, even late ones */
+#define EF_PRIO		0x60		/* Priority, EVENT_PRIO_ below */
+
+/*
+ * What happens when an event falls behind, e.g. because it is still waiting
+ * to run when it comes due again. By default the late deadlines are
+ * coalesced into one run and counted as missed. EVENT_CATCHUP runs the
+ * callback once for each of them instead, as soon as it can.
+ */
+#define EVENT_COALESCE	0
+#define EVENT_CATCHUP	EF_CATCHUP
+
+/*
+ * Priority, or'ed into the flags for event_register_flags(). Everything
+ * queued at a higher priority runs before anything at a lower one, and low
+ * priority work is put off to the next tick once the callbacks this tick
+ * have used up EVENT_BUDGET cycles. Use high for anything that matters to
+ * the autopilot state and low for the purely cosmetic.
+ */
+#define EVENT_PRIO_NORMAL	0x00
+#define EVENT_PRIO_HIGH		0x20
+#define EVENT_PRIO_LOW		0x40
+
+#define EVENT_PRIOS			3		/* Number of ready queues */
+
+/*
+ * Compare ticks so that it still works when the count wraps
+ */
+#define EVENT_DUE(when, now)	((int32_t)((now) - (when)) >= 0)
+
+#if EVENT_PROFILE
+#define EVENT_PROF_NONE	0xFF
+
+/*
+ * Execution statistics for one callback function, times are in CPU cycles
+ */
+typedef struct event_prof_s {
+	void		(*p_func)();	/* Callback these figures are for, NULL if unused */
+	uint16_t	p_calls;		/* Number of times run */
+	uint16_t	p_misses;		/* Deadlines coalesced away, so never run */
+	uint32_t	p_min;
+	uint32_t	p_max;
+	uint32_t	p_total;		/* For the mean, p_total / p_calls */
+} event_prof_t;
+
+/*
+ * Time from being queued to starting to run, per priority, in CPU cycles
+ */
+typedef struct event_lat_s {
+	uint16_t	l_runs;
+	uint16_t	l_deferred;		/* Ticks with low priority work put off */
+	uint32_t	l_max;
+	uint32_t	l_total;		/* For the mean, l_total / l_runs */
+} event_lat_t;
+#endif
+
 typedef uint8_t event_handle;
 
-extern event_handle event_register(void (*func)(), uint8_t period, uint8_t occurrences);
+extern event_handle event_register(void (*func)(), uint16_t ms, uint8_t occurrences);
+extern event_handle event_register_flags(void (*func)(), uint16_t ms, uint8_t occurrences, uint8_t flags);
 extern uint8_t event_cancel(volatile event_handle *h);
 extern void event_reset(event_handle h);
-extern void inline event_init();
-extern void event_tick();
+extern void event_schedule(event_handle h, uint16_t ms);
+extern void event_init(void);
+extern void event_tick(uint32_t now);
+extern void event_run();
+extern void event_post(event_handle h);
+extern uint8_t event_pending();
+extern volatile uint16_t event_missed;
+#if EVENT_PROFILE
+extern uint8_t event_prof_line(uint8_t n, char *buf, uint8_t size);
+extern void event_prof_reset();
+#endif
 #endif
@@ -0,0 +1,298 @@
+/*
+ * Time event_tick() with a number of events registered, against the old
+ * scan of the whole event_list. This is a host program, not part of the
+ * firmware, it builds event.c with the AVR parts stubbed out:
+ *
+ *	cc -std=gnu99 -O2 -o event_bench event_bench.c
+ *	event_bench 10 64 255
+ *
+ * Each event has a period of 200 to 250 ticks (1 to 1.25 sec). The old scan
+ * is timed over a list the size of the number of events, as if EVENT_MAX
+ * had been set to that. EVENT_MAX is built as 255, the most a handle can
+ * address, so 256 events can't be asked for. The ready queues are made big
+ * enough that none of the runs are dropped.
+ *
+ *	event_bench -o [ticks]
+ *
+ * instead overloads a simulated 16MHz CPU and prints the queue to run
+ * latency for each priority, as the console "stats" command would.
+ * Callbacks burn simulated cycles, and the tick interrupt and button
+ * presses come in between them as they would on the AVR. Each tick has a 30000 cycle
+ * callback, every other tick a second one, both normal priority. Four low
+ * priority blinks of 5000 cycles are due every tick, and a 200 cycle high
+ * priority button handler is posted at random, about every 7 ticks. That is
+ * run once with those priorities and once with everything normal, and the
+ * button's own latency is printed under the priorities.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define F_CPU		16000000UL
+#define EVENT_MAX	255
+#define EVENT_READY_SIZE 256	// Room for every event to be due at once
+#define EVENT_HOST
+#define FR_HOST
+
+#define PSTR(s)					(s)
+#define printf_P				printf
+#define snprintf_P				snprintf
+#define cli()					do { } while (0)
+#define sei()					do { } while (0)
+#define fr_log(id, arg, data)	do { } while (0)
+
+#include "event.c"
+
+#define BENCH_TICKS	1000000L
+
+/*
+ * The simulated cycle count, only the overload run moves it
+ */
+static uint32_t bench_cycles;
+
+uint32_t clock_cycles(void)
+{
+	return bench_cycles;
+}
+
+static volatile uint32_t bench_runs;
+
+static void bench_func(__attribute__((unused)) uint32_t t)
+{
+	bench_runs++;
+}
+
+/*
+ * The baseline event_tick(), less the callbacks
+ */
+typedef struct old_event_s {
+	uint16_t	e_when;
+	uint16_t	e_period;
+	uint8_t		e_occurrences;
+	void		(*e_func)();
+} old_event_t;
+
+static volatile old_event_t old_list[EVENT_MAX];
+
+static void old_tick(uint8_t n, uint16_t tick)
+{
+	uint8_t i;
+
+	for (i = n - 1; i > 0; i--) {
+		if (old_list[i].e_func && old_list[i].e_when == tick) {
+			if (old_list[i].e_occurrences) {
+				if (--old_list[i].e_occurrences == 0)
+					old_list[i].e_func = NULL;
+				else
+					old_list[i].e_when = tick + old_list[i].e_period;
+			} else
+				old_list[i].e_when = tick + old_list[i].e_period;
+			bench_runs++;
+		}
+	}
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench_old(int n)
+{
+	double t, total = 0;
+	long i;
+
+	for (i = 0; i < n; i++) {
+		old_list[i].e_func = bench_func;
+		old_list[i].e_period = 200 + i % 51;
+		old_list[i].e_when = old_list[i].e_period;
+		old_list[i].e_occurrences = 0;
+	}
+
+	for (i = 1; i <= BENCH_TICKS; i++) {
+		t = bench_now();
+		old_tick(n, i);
+		total += bench_now() - t;
+	}
+	return total / BENCH_TICKS;
+}
+
+static double bench_wheel(int n)
+{
+	double t, total = 0;
+	long i;
+
+	event_init();
+	tick = 0;
+	for (i = 0; i < n; i++) {
+		if (!event_register(bench_func, (200 + i % 51) * CLOCK_MS, 0)) {
+			fprintf(stderr, "event_register() failed at %ld\n", i);
+			exit(1);
+		}
+	}
+
+	for (i = 1; i <= BENCH_TICKS; i++) {
+		t = bench_now();
+		event_tick(i);
+		total += bench_now() - t;
+		event_run();
+	}
+	return total / BENCH_TICKS;
+}
+
+/*
+ * The overload run
+ */
+#define BENCH_TICK_CYCLES	(F_CPU / CLOCK)
+#define BENCH_HOG			30000		// Normal priority, every tick and every other
+#define BENCH_BLINK			5000		// Low priority, four every tick
+#define BENCH_BLINKS		4
+#define BENCH_BUTTON		200			// High priority, posted from "interrupts"
+#define BENCH_PRESS			(7 * BENCH_TICK_CYCLES)	// Mean cycles between presses
+
+static uint32_t bench_tick_at;			/* bench_cycles of the next tick */
+static uint32_t bench_press_at;			/* and of the next button press */
+static uint32_t bench_ticks;
+static event_handle bench_button_h;
+static uint32_t bench_button_runs, bench_button_max, bench_button_total;
+
+/*
+ * Let n cycles go by, taking the interrupts that come due meanwhile
+ */
+static void bench_burn(uint32_t n)
+{
+	uint32_t next;
+
+	while (n) {
+		next = bench_tick_at - bench_cycles;
+		if (bench_press_at - bench_cycles < next)
+			next = bench_press_at - bench_cycles;
+		if (n < next) {
+			bench_cycles += n;
+			return;
+		}
+		bench_cycles += next;
+		n -= next;
+
+		if (bench_cycles == bench_press_at) {
+			event_post(bench_button_h);
+			bench_press_at += 1 + rand() % (2 * BENCH_PRESS);
+		}
+		if (bench_cycles == bench_tick_at) {
+			bench_tick_at += BENCH_TICK_CYCLES;
+			event_tick(++bench_ticks);
+		}
+	}
+}
+
+static void bench_hog(__attribute__((unused)) uint32_t t)
+{
+	bench_burn(BENCH_HOG);
+}
+
+static void bench_blink(__attribute__((unused)) uint32_t t)
+{
+	bench_burn(BENCH_BLINK);
+}
+
+static void bench_button(__attribute__((unused)) uint32_t t)
+{
+	uint32_t lat = bench_cycles - EV(bench_button_h).e_queued;
+
+	bench_button_runs++;
+	bench_button_total += lat;
+	if (lat > bench_button_max)
+		bench_button_max = lat;
+	bench_burn(BENCH_BUTTON);
+}
+
+static void bench_overload(long ticks, uint8_t prio)
+{
+	static const char *name[EVENT_PRIOS] = { "high", "norm", "low" };
+	event_lat_t *l;
+	uint32_t next;
+	int i;
+
+	event_init();
+	event_prof_reset();
+	event_missed = 0;
+	tick = 0;
+	srand(1);
+	bench_ticks = 0;
+	bench_cycles = 0;
+	bench_tick_at = BENCH_TICK_CYCLES;
+	bench_press_at = 1 + rand() % (2 * BENCH_PRESS);
+	bench_button_runs = bench_button_max = bench_button_total = 0;
+
+	event_register(bench_hog, CLOCK_MS, 0);
+	event_register(bench_hog, 2 * CLOCK_MS, 0);
+	for (i = 0; i < BENCH_BLINKS; i++)
+		event_register_flags(bench_blink, CLOCK_MS, 0, prio ? EVENT_PRIO_LOW : EVENT_PRIO_NORMAL);
+	bench_button_h = event_register_flags(bench_button, 0, 0, prio ? EVENT_PRIO_HIGH : EVENT_PRIO_NORMAL);
+
+	/* fsbus_main(), sleeping to the next interrupt when there's nothing to do */
+	while (bench_ticks < ticks) {
+		event_run();
+		if (!event_pending()) {
+			next = bench_tick_at - bench_cycles;
+			if (bench_press_at - bench_cycles < next)
+				next = bench_press_at - bench_cycles;
+			bench_burn(next);
+		}
+	}
+
+	printf("%s, %ld ticks, missed deadlines %u\n", prio ? "priorities" : "all normal", ticks, event_missed);
+	printf("prio   runs defer  max lat us  mean lat us\n");
+	for (i = 0; i < EVENT_PRIOS; i++) {
+		l = &event_lat[i];
+		printf("%-5s %5u %5u %11.1f %12.1f\n", name[i], l->l_runs, l->l_deferred,
+			l->l_max / (F_CPU / 1e6), l->l_runs ? l->l_total / l->l_runs / (F_CPU / 1e6) : 0.0);
+	}
+	printf("button%5u       %11.1f %12.1f\n", bench_button_runs, bench_button_max / (F_CPU / 1e6),
+		bench_button_runs ? bench_button_total / bench_button_runs / (F_CPU / 1e6) : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	double overhead, t;
+	int i, n;
+	long j;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: event_bench events ...\n       event_bench -o [ticks]\n");
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "-o")) {
+		j = argc > 2 ? atol(argv[2]) : 2000;
+		bench_overload(j, 1);
+		printf("\n");
+		bench_overload(j, 0);
+		return 0;
+	}
+
+	/* The cost of the timing itself, taken off the results */
+	overhead = 0;
+	for (j = 0; j < BENCH_TICKS; j++) {
+		t = bench_now();
+		overhead += bench_now() - t;
+	}
+	overhead /= BENCH_TICKS;
+
+	printf("events   old ns/tick  wheel ns/tick\n");
+	for (i = 1; i < argc; i++) {
+		n = atoi(argv[i]);
+		if (n < 1 || n > EVENT_MAX) {
+			fprintf(stderr, "events must be 1 to %d\n", EVENT_MAX);
+			return 1;
+		}
+		printf("%6d %13.1f %14.1f\n", n, bench_old(n) - overhead, bench_wheel(n) - overhead);
+	}
+	printf("missed deadlines %u\n", event_missed);
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+
+#include "clock.h"
+#include "fr.h"
+
+#if (FR_SIZE > 0)
+
+volatile fr_rec_t fr_ring[FR_SIZE];
+volatile uint8_t fr_head;
+volatile uint8_t fr_frozen;
+
+static uint8_t fr_dump_head;
+
+/*
+ * Line n of the ring dump, oldest first, for fr_decode. The console sends
+ * it out a line at a time. Recording stops from the first line to the last
+ * so the ring doesn't get written over underneath it, and starts again
+ * afresh afterwards. An empty slot gives an empty line. Returns 0 past the
+ * end.
+ */
+uint8_t fr_line(uint8_t n, char *buf, uint8_t size)
+{
+	fr_rec_t r;
+	uint8_t i;
+
+	if (n == 0) {
+		fr_log(FR_DUMP, 0, clock_now());
+
+		cli();
+		fr_frozen = 1;
+		fr_dump_head = fr_head;
+		sei();
+
+		snprintf_P(buf, size, PSTR("fr begin\n\r"));
+		return 1;
+	}
+
+	if (n <= FR_SIZE) {
+		cli();
+		r = fr_ring[(fr_dump_head + n - 1) & (FR_SIZE - 1)];
+		sei();
+
+		buf[0] = '\0';
+		if (r.fr_id != FR_NONE)
+			snprintf_P(buf, size, PSTR("fr %02x %02x %04x %04x\n\r"), r.fr_id, r.fr_arg, r.fr_time, r.fr_data);
+		return 1;
+	}
+
+	if (n == FR_SIZE + 1) {
+		snprintf_P(buf, size, PSTR("fr end\n\r"));
+
+		cli();
+		for (i = 0; i < FR_SIZE; i++)
+			fr_ring[i].fr_id = FR_NONE;
+		fr_frozen = 0;
+		sei();
+		return 1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _FR_H_
+#define _FR_H_
+
+/*
+ * The flight recorder. A ring of small binary records in SRAM, written from
+ * interrupt handlers and the main loop alike at a cost of a few dozen
+ * cycles, so the FSBUS byte stream, the event wheel and the switches can be
+ * watched at full speed where printf at 4800 baud never could.
+ *
+ * The console "fr" command prints the ring, oldest first, one record to a
+ * line:
+ *
+ *	fr <id> <arg> <time> <data>
+ *
+ * all in hex, and fr_decode (built on the host, see fr_decode.c) turns that
+ * into a timeline. Times are TCNT1, which counts at clk/8 and wraps every
+ * 32.768ms at 16MHz. The FR_EVENT records carry the tick count, which is
+ * enough for fr_decode to put the wraps back in.
+ *
+ * FR_SIZE records of 6 bytes are kept, a power of 2 no more than 128. Set it
+ * to 0 to leave the recorder out altogether.
+ */
+#ifndef FR_SIZE
+#define FR_SIZE		64
+#endif
+
+/* Record ids, 0 is an empty slot */
+#define FR_NONE		0
+#define FR_RCV		1		// fsbus_rcv(): arg byte, data CID
+#define FR_EVENT	2		// event_tick() fired an event: arg handle, data tick
+#define FR_SWITCH	3		// switches_tick() saw a change: arg encoder, data port A << 8 | port B
+#define FR_BUTTON	4		// KAP140 button handled: arg FR_BTN_*, data ap_mode << 8 | rhs_mode
+#define FR_DUMP		5		// Start of a dump: data tick
+
+/* FR_BUTTON args */
+#define FR_BTN_AP		1
+#define FR_BTN_HDG		2
+#define FR_BTN_NAV		3
+#define FR_BTN_APR		4
+#define FR_BTN_REV		5
+#define FR_BTN_ALT		6
+#define FR_BTN_UP		7
+#define FR_BTN_DOWN		8
+#define FR_BTN_ARM		9
+#define FR_BTN_BARO		10
+#define FR_BTN_ENC		11	// data is the encoder delta
+#define FR_BTN_TOGGLE	12
+
+typedef struct fr_rec_s {
+	uint8_t		fr_id;
+	uint8_t		fr_arg;
+	uint16_t	fr_time;		/* TCNT1 */
+	uint16_t	fr_data;
+} fr_rec_t;
+
+#ifndef FR_HOST
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#if (FR_SIZE > 0)
+
+#if (FR_SIZE > 128 || (FR_SIZE & (FR_SIZE - 1)))
+#error FR_SIZE must be a power of 2 no more than 128
+#endif
+
+extern volatile fr_rec_t fr_ring[FR_SIZE];
+extern volatile uint8_t fr_head;
+extern volatile uint8_t fr_frozen;
+
+/*
+ * Add a record. Safe from interrupt handlers and the main loop.
+ */
+static inline void fr_log(uint8_t id, uint8_t arg, uint16_t data)
+{
+	volatile fr_rec_t *r;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if (!fr_frozen) {
+		r = &fr_ring[fr_head++ & (FR_SIZE - 1)];
+		r->fr_id = id;
+		r->fr_arg = arg;
+		r->fr_time = TCNT1;
+		r->fr_data = data;
+	}
+	SREG = sreg;
+}
+
+extern uint8_t fr_line(uint8_t n, char *buf, uint8_t size);
+
+#else
+
+#define fr_log(id, arg, data)	do { } while (0)
+
+#endif
+
+#endif
+
+#endif
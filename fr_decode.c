@@ -0,0 +1,95 @@
+/*
+ * Turn a flight recorder dump (the console "fr" command) into a timeline.
+ * This is a host program, not part of the firmware:
+ *
+ *	cc -o fr_decode fr_decode.c
+ *	fr_decode < capture.txt
+ *
+ * Anything that isn't a record line is ignored, so a raw capture of the
+ * console will do. Times are from the first record, in msec.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FR_HOST
+#include "fr.h"
+
+#define FR_TCNT_US	0.5			// TCNT1 at clk/8, 16MHz
+#define FR_WRAP_US	(65536 * FR_TCNT_US)
+#define FR_TICK_US	5000.0		// clock.h CLOCK
+
+static const char *fr_btn[] = {
+	"?", "AP", "HDG", "NAV", "APR", "REV", "ALT", "UP", "DOWN", "ARM", "BARO", "ENC", "TOGGLE"
+};
+
+int main(void)
+{
+	char line[128], *p;
+	unsigned id, arg, time, data;
+	uint16_t last_time = 0, anchor_tick = 0;
+	double now = 0, anchor = 0;
+	int first = 1, anchored = 0;
+	long wraps;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		// The console ends lines with \n\r, so the \r starts the next one
+		for (p = line; *p == '\r'; p++)
+			;
+
+		if (sscanf(p, "fr %x %x %x %x", &id, &arg, &time, &data) != 4) {
+			if (!strncmp(p, "fr begin", 8)) {
+				first = 1;		// a new dump
+				anchored = 0;
+				now = 0;
+			}
+			continue;
+		}
+
+		// Assume less than a TCNT1 wrap since the last record...
+		if (!first)
+			now += (uint16_t)(time - last_time) * FR_TCNT_US;
+		first = 0;
+		last_time = time;
+
+		// ...unless the tick count says otherwise
+		if (id == FR_EVENT || id == FR_DUMP) {
+			if (anchored) {
+				wraps = (long)(((uint16_t)(data - anchor_tick) * FR_TICK_US - (now - anchor)) / FR_WRAP_US + 0.5);
+				if (wraps > 0)
+					now += wraps * FR_WRAP_US;
+			}
+			anchored = 1;
+			anchor = now;
+			anchor_tick = data;
+		}
+
+		printf("%10.3f  ", now / 1000);
+		switch (id) {
+		case FR_RCV:
+			printf("rcv     0x%02x%s cid %u\n", arg, arg & 0x80 ? " start" : "", data);
+			break;
+		case FR_EVENT:
+			printf("event   %u at tick %u\n", arg, data);
+			break;
+		case FR_SWITCH:
+			printf("switch  A 0x%02x B 0x%02x enc %d\n", data >> 8, data & 0xff, (int8_t)arg);
+			break;
+		case FR_BUTTON:
+			if (arg == FR_BTN_ENC)
+				printf("button  ENC %d\n", (int16_t)data);
+			else
+				printf("button  %s ap_mode 0x%02x rhs_mode 0x%02x\n",
+					arg < sizeof(fr_btn) / sizeof(fr_btn[0]) ? fr_btn[arg] : "?", data >> 8, data & 0xff);
+			break;
+		case FR_DUMP:
+			printf("dump    at tick %u\n", data);
+			break;
+		default:
+			printf("?%02x     %02x %04x\n", id, arg, data);
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -43,13 +43,32 @@
 #define FS_DF_B1_V0			0x01		// V0
 #define FS_DF_B3_V1_7		0x7F		// V1 to V7
 
+#define FS_CID_MAX			32			// CIDs are the 5 bits under FS_DF_CID_MASK
+
+
+#define FS_DISPLAY_LEN		5			// Display dataframe, start byte and four bytes of digits
+
+/*
+ * What a display shows. Read it with fsbus_display_read().
+ */
+typedef struct fsbus_value_s {
+	int32_t fv_value;			// The digits as a number, if fv_valid
+	uint8_t fv_valid;			// Only digits, '-' and blanks
+	uint8_t fv_codes[3];		// The digit codes as received, two to a byte
+} fsbus_value_t;
+
+#define FS_VALUE_STR	7		// fsbus_value_str() buffer
 
 typedef struct fsbus_display {
 	uint8_t fs_bright;
 	uint8_t fs_power;
 	uint8_t fs_decimal_point;
 	uint8_t fs_base_bright;
-	uint8_t fs_digits[7];
+	volatile uint8_t fs_seq;	// Odd while fs_val is being written
+	fsbus_value_t fs_val;		// The latest value, older ones are overwritten
+	uint8_t fs_last[FS_DISPLAY_LEN];	// The last frame decoded
+	uint8_t fs_last_len;
+	uint16_t fs_suppressed;		// Frames the same as the last, not decoded
 } fsbus_display_t;
 
 typedef struct fsbus_dio {
@@ -77,6 +96,28 @@ typedef struct fsbus_block_s {
 
 typedef unsigned char fsbus_handle;
 
+/*
+ * fs_rcv_len outside a frame. After an error bytes are skipped up to the
+ * next start byte.
+ */
+#define FS_RCV_DONE		0xfe		// Frame complete, next byte must be a start
+#define FS_RCV_SKIP		0xff		// Skipping to the next start byte
+
+/*
+ * Receive errors, see fsbus_errors
+ */
+#define FS_ERR_FRAMING	0x01		// A frame cut short or a byte outside one
+#define FS_ERR_OVERRUN	0x02		// A frame too long for fs_rcv_buf
+#define FS_ERR_UNKNOWN	0x04		// A command the controller doesn't take
+
+typedef struct fsbus_errors_s {
+	uint16_t	fe_framing;
+	uint16_t	fe_overrun;
+	uint16_t	fe_unknown;
+} fsbus_errors_t;
+
+extern volatile fsbus_errors_t fsbus_errors;
+
 
 void fsbus_rcv(uint8_t c);
 void fsbus_snd(uint8_t cid, uint8_t rcmd, int8_t rcmd_v, uint8_t rcmd_len);
@@ -84,8 +125,11 @@ void fsbus_init(void);
 void fsbus_main(void);
 fsbus_block_t *fsbus_register(uint8_t cid, uint8_t ctrl_type, void (*update)(fsbus_block_t *fs_blk));
 fsbus_block_t *fs_get_blk(uint8_t cid);
+void fsbus_set_cid(fsbus_block_t *fs_blk, uint8_t cid);
 
 void fsbus_display_decode(fsbus_block_t *fs_blk);
+uint8_t fsbus_display_read(fsbus_block_t *fs_blk, fsbus_value_t *v, uint8_t *seq);
+char *fsbus_value_str(const fsbus_value_t *v, char *buf);
 void fsbus_dio_decode(fsbus_block_t *fs_blk);
 
 #endif /*FSBUS_H_*/
@@ -0,0 +1,102 @@
+/*
+ * Check that SETCID moves a DIO controller in fs_cid_map. This is a host
+ * program, not part of the firmware, it builds fsbus_rcv.c, fsbus_main.c
+ * and fsbus_dio.c with the AVR parts stubbed out:
+ *
+ *	cc -std=gnu99 -O2 -o fsbus_cid_test fsbus_cid_test.c
+ *	fsbus_cid_test
+ *
+ * Frames are put together here rather than with fsbus_snd(), which puts
+ * bit 7 of the command in V0, and fed a byte at a time to fsbus_rcv().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FSBUS_HOST
+#define FR_HOST
+
+#define PROGMEM
+#define pgm_read_byte(p)		(*(const uint8_t *)(p))
+#define fr_log(id, arg, data)	do { } while (0)
+#define _BV(b)					(1 << (b))
+#define PSTR(s)					(s)
+#define trace_on(mod, lvl)		0
+#define trace_P(fmt, ...)		do { } while (0)
+#define trace_debug(mod, fmt, ...)	do { } while (0)
+
+#include "fsbus_rcv.c"
+#include "fsbus_main.c"
+#include "fsbus_dio.c"
+
+void fsbus_display_decode(__attribute__((unused)) fsbus_block_t *blk)
+{
+}
+
+static int test_fails;
+
+#define test_check(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			test_fails++; \
+		} \
+	} while (0)
+
+/*
+ * Send a DIO R-command to cid, a 3 byte frame if it has a value
+ */
+static void test_send(uint8_t cid, uint8_t rcmd, uint8_t v, uint8_t len)
+{
+	fsbus_rcv(FS_DF_START | cid << 2 | (rcmd & 0x80) >> 6 | (v & FS_DF_B1_V0));
+	fsbus_rcv(rcmd & FS_DF_B2_CMD_MASK);
+	if (len == 3)
+		fsbus_rcv(v >> 1);
+}
+
+int main(void)
+{
+	fsbus_block_t *a, *b, *d;
+
+	fsbus_init();
+	a = fsbus_register(5, FS_CTRL_DIO, NULL);
+	b = fsbus_register(9, FS_CTRL_DIO, NULL);
+	d = fsbus_register(16, FS_CTRL_DISPLAY, NULL);
+	test_check(fs_get_blk(5) == a && fs_get_blk(9) == b && fs_get_blk(16) == d);
+
+	/* Move a from 5 to 12, and it answers there */
+	test_send(5, FS_RCMD_SETCID, 12, 3);
+	test_check(a->fs_cid == 12);
+	test_check(fs_cid_map[5] == NULL);
+	test_check(fs_cid_map[12] == a);
+	test_send(12, FS_RCMD_D_OUTBYTE0, 0x55, 3);
+	test_check(a->fs_dio.fs_dout[0] == 0x55);
+	test_send(5, FS_RCMD_D_OUTBYTE0, 0xaa, 3);
+	test_check(a->fs_dio.fs_dout[0] == 0x55);
+
+	/* An odd CID, so V0 in the start byte matters */
+	test_send(9, FS_RCMD_SETCID, 7, 3);
+	test_check(b->fs_cid == 7 && fs_cid_map[7] == b && fs_cid_map[9] == NULL);
+
+	/* Onto a CID in use: the first registered keeps the map entry */
+	test_send(7, FS_RCMD_SETCID, 12, 3);
+	test_check(b->fs_cid == 12 && fs_cid_map[12] == a && fs_cid_map[7] == NULL);
+	test_send(12, FS_RCMD_SETCID, 3, 3);
+	test_check(a->fs_cid == 3 && fs_cid_map[3] == a && fs_cid_map[12] == b);
+
+	/* A broadcast SETCID moves nothing */
+	test_send(0, FS_RCMD_SETCID, 20, 3);
+	test_check(a->fs_cid == 3 && b->fs_cid == 12 && d->fs_cid == 16);
+	test_check(fs_cid_map[20] == NULL);
+
+	/* The other common commands reach DIO controllers too */
+	test_send(3, FS_RCMD_RESET, 0, 2);
+	test_check(a->fs_dio.fs_dout[0] == 0);
+
+	test_check(fsbus_errors.fe_framing == 0 && fsbus_errors.fe_overrun == 0 &&
+		fsbus_errors.fe_unknown == 0);
+
+	printf("fsbus_cid_test: %s\n", test_fails ? "FAILED" : "ok");
+	return test_fails != 0;
+}
@@ -3,9 +3,14 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
-#include <avr/io.h>
 #include <stdint.h>
+#ifndef FSBUS_HOST
+#include <avr/io.h>
+#endif
 #include "fsbus.h"
+#ifndef FSBUS_HOST
+#include "trace.h"
+#endif
 
 
 void fsbus_dio_decode(fsbus_block_t *fs_blk)
@@ -13,7 +18,7 @@ void fsbus_dio_decode(fsbus_block_t *fs_blk)
 	int i;
 	fsbus_dio_t *iop;
 
-	printf("fsbus_dio_decode:enter\n\r");
+	trace_debug(FSBUS, "fsbus_dio_decode:enter\n\r");
 
 	iop = &fs_blk->fs_dio;
 
@@ -29,6 +34,7 @@ void fsbus_dio_decode(fsbus_block_t *fs_blk)
 
 	case FS_RCMD_SETCID:
 //		printf("fsbus_dio_decode:FS_RCMD_SETCID\n\r");
+		fsbus_set_cid(fs_blk, fs_blk->fs_rcmd_v);
 		break;
 
 	case FS_RCMD_SETBRIGHT:
@@ -59,11 +65,11 @@ void fsbus_dio_decode(fsbus_block_t *fs_blk)
 				iop->fs_dout[i/8] &= ~(_BV(i % 8));
 			else
 				iop->fs_dout[i/8] |= _BV(i % 8);
-			printf("fsbus_dio_decode: (OUTBIT) DOUT %d, bit %d = 0x%x\n\r", i/8, i % 8, fs_blk->fs_rcmd_v);			
+			trace_debug(FSBUS, "fsbus_dio_decode: (OUTBIT) DOUT %d, bit %d = 0x%x\n\r", i/8, i % 8, fs_blk->fs_rcmd_v);			
 		} else if (fs_blk->fs_rcmd >= FS_RCMD_D_OUTBYTE0 && fs_blk->fs_rcmd <= FS_RCMD_D_OUTBYTE3) {
 			i = fs_blk->fs_rcmd - FS_RCMD_D_OUTBYTE0;
 			iop->fs_dout[i] = fs_blk->fs_rcmd_v;
-			printf("fsbus_dio_decode: (OUTBYTE) DOUT %d = 0x%x\n\r", i, fs_blk->fs_rcmd_v);
+			trace_debug(FSBUS, "fsbus_dio_decode: (OUTBYTE) DOUT %d = 0x%x\n\r", i, fs_blk->fs_rcmd_v);
 
 		} else {
 //			printf("fsbus_dio_decode: Unknown command\n\r");
@@ -71,12 +77,12 @@ void fsbus_dio_decode(fsbus_block_t *fs_blk)
 		break;
 	}
 
-	printf("fsbus_dio_decode: Bytes 0x ");
-
-	for (i = 0; i < fs_blk->fs_rcv_len; i++) {
-		printf("%x ", fs_blk->fs_rcv_buf[i]); 
+	if (trace_on(FSBUS, TRACE_DEBUG)) {
+		trace_P(PSTR("fsbus_dio_decode: Bytes 0x "));
+		for (i = 0; i < fs_blk->fs_rcv_len; i++)
+			trace_P(PSTR("%x "), fs_blk->fs_rcv_buf[i]);
+		trace_P(PSTR("\n\r"));
 	}
-	printf("\n\r");
 
-	printf("fsbus_dio_decode:exit\n\r");
+	trace_debug(FSBUS, "fsbus_dio_decode:exit\n\r");
 }
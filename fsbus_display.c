@@ -22,11 +22,115 @@ static const unsigned char fs_display_conv[] = { '0', '1', '2', '3',
 #define DIG_F 0
 #define DIG_NULL 6
 
+#define FS_CODE_MINUS	10		// fs_display_conv[] '-'
+#define FS_CODE_BLANK	15		// fs_display_conv[] ' '
+
+/*
+ * Each display's fs_val is a mailbox: the receive side overwrites it with
+ * each new value and readers take the latest when it suits them. fs_seq
+ * is a sequence lock around it, odd while a write is in progress, so a
+ * reader can tell it has a consistent copy and whether anything has changed
+ * since it last looked. It's 8 bits, so a reader must look at least every
+ * 127 updates. Writers may be in an interrupt handler, readers must not be.
+ */
+#define FS_BARRIER()	__asm__ __volatile__ ("" ::: "memory")
+
+static inline void fs_display_publish(fsbus_display_t *dp, int32_t value, uint8_t valid, const uint8_t *codes)
+{
+	dp->fs_seq++;
+	FS_BARRIER();
+	dp->fs_val.fv_value = value;
+	dp->fs_val.fv_valid = valid;
+	dp->fs_val.fv_codes[0] = codes[0];
+	dp->fs_val.fv_codes[1] = codes[1];
+	dp->fs_val.fv_codes[2] = codes[2];
+	FS_BARRIER();
+	dp->fs_seq++;
+}
+
+/*
+ * Copy out the latest value of a display, if it has changed since *seq (the
+ * sequence number of the copy the caller already has, 0 for none). Returns
+ * 1 with *v and *seq updated, or 0 if there's nothing new.
+ */
+uint8_t fsbus_display_read(fsbus_block_t *fs_blk, fsbus_value_t *v, uint8_t *seq)
+{
+	fsbus_display_t *dp = &fs_blk->fs_display;
+	uint8_t s;
+
+	do {
+		s = dp->fs_seq;
+		if (s == *seq)
+			return 0;
+		FS_BARRIER();
+		*v = dp->fs_val;
+		FS_BARRIER();
+	} while ((s & 1) || dp->fs_seq != s);
+
+	*seq = s;
+	return 1;
+}
+
+/*
+ * A display value as text, into buf of FS_VALUE_STR bytes
+ */
+char *fsbus_value_str(const fsbus_value_t *v, char *buf)
+{
+	uint8_t i;
+
+	for (i = 0; i < 6; i++)
+		buf[i] = fs_display_conv[(v->fv_codes[i >> 1] >> ((i & 1) * 4)) & 0x0F];
+	buf[DIG_NULL] = 0;
+
+	return buf;
+}
+
+/*
+ * Take the digit codes of a display dataframe, working out the number they
+ * show on the way. The text is left for fsbus_value_str() to build, if
+ * anything wants it.
+ *
+ * Non-digits are skipped, as atoi() of the text used to, with a '-' anywhere
+ * making the number negative. Letters make it not a number.
+ */
+static void fs_display_digits(fsbus_block_t *fs_blk, fsbus_display_t *dp)
+{
+	uint8_t *b = fs_blk->fs_rcv_buf;
+	uint8_t code[6], packed[3], i, c, minus = 0, valid = 1;
+	uint32_t v = 0;
+
+	code[DIG_A] = ((b[1] & 0x30) >> 2) | ((b[2] & 0x30) >> 4);
+	code[DIG_B] = b[1] & 0x0F;
+	code[DIG_C] = b[2] & 0x0F;
+	code[DIG_D] = ((b[3] & 0x30) >> 2) | ((b[4] & 0x30) >> 4);
+	code[DIG_E] = b[3] & 0x0F;
+	code[DIG_F] = b[4] & 0x0F;
+
+	for (i = 0; i < 6; i++) {
+		c = code[i];
+		if (c < 10) {
+			v = (v << 2) + v;		// v * 10 without a 32 bit multiply
+			v = (v << 1) + c;
+		} else if (c == FS_CODE_MINUS) {
+			minus = 1;
+		} else if (c != FS_CODE_BLANK) {
+			valid = 0;
+		}
+	}
+
+	packed[0] = code[0] | code[1] << 4;
+	packed[1] = code[2] | code[3] << 4;
+	packed[2] = code[4] | code[5] << 4;
+
+	fs_display_publish(dp, minus ? -(int32_t)v : (int32_t)v, valid, packed);
+}
+
 
 void fsbus_display_decode(fsbus_block_t *fs_blk)
 {
 
 	fsbus_display_t *dp;
+	static const uint8_t zeros[3];	// "000000"
 
 
 	dp = &fs_blk->fs_display;
@@ -36,16 +140,12 @@ void fsbus_display_decode(fsbus_block_t *fs_blk)
 //		printf("fsbus_display_decode:FS_RCMD_RESET\n\r");
 		dp->fs_power = 100;
 		dp->fs_decimal_point = 0; // OFF
-		dp->fs_digits[DIG_A] = '0';
-		dp->fs_digits[DIG_B] = '0';
-		dp->fs_digits[DIG_C] = '0';
-		dp->fs_digits[DIG_D] = '0';
-		dp->fs_digits[DIG_E] = '0';
-		dp->fs_digits[DIG_F] = '0';
+		fs_display_publish(dp, 0, 1, zeros);
 		break;
 
 	case FS_RCMD_SETCID:
 //		printf("fsbus_display_decode:FS_RCMD_SETCID\n\r");
+		fsbus_set_cid(fs_blk, fs_blk->fs_rcmd_v);
 		break;
 
 	case FS_RCMD_SETBRIGHT:
@@ -71,17 +171,9 @@ void fsbus_display_decode(fsbus_block_t *fs_blk)
 	case FS_RCMD_DISPLAY:
 		//printf("fsbus_display_decode:FS_RCMD_DISPLAY\n\r");
 
-		dp->fs_digits[DIG_A] = fs_display_conv[((fs_blk->fs_rcv_buf[1] & 0x30) >> 2) | ((fs_blk->fs_rcv_buf[2] & 0x30) >> 4)];
-		dp->fs_digits[DIG_B] = fs_display_conv[(fs_blk->fs_rcv_buf[1] & 0x0F)];
-		dp->fs_digits[DIG_C] = fs_display_conv[(fs_blk->fs_rcv_buf[2] & 0x0F)];
-
-		dp->fs_digits[DIG_D] = fs_display_conv[((fs_blk->fs_rcv_buf[3] &0x30) >> 2) | ((fs_blk->fs_rcv_buf[4] & 0x30) >> 4)];
-		dp->fs_digits[DIG_E] = fs_display_conv[(fs_blk->fs_rcv_buf[3] & 0x0F)];
-		dp->fs_digits[DIG_F] = fs_display_conv[(fs_blk->fs_rcv_buf[4] & 0x0F)];
-
-		dp->fs_digits[DIG_NULL] = 0;
+		fs_display_digits(fs_blk, dp);
 
-		//printf("fsbus_display_decode: Display '%s'\n\r", dp->fs_digits);
+		//printf("fsbus_display_decode: Display %ld\n\r", dp->fs_val.fv_value);
 		
 		break;
 
@@ -2,18 +2,50 @@
  * This file contains the registration and general FSBUS routines
  */
 #include <stdlib.h>
-#include <avr/io.h>
 #include <stdint.h>
+#ifndef FSBUS_HOST
+#include <avr/io.h>
+#endif
 
 #include "fsbus.h"
+#ifndef FSBUS_HOST
 #include "uart.h"
+#include "event.h"
+#include "clock.h"
+#include "lcd.h"
+#endif
 
 
+#ifndef MAX_RCV_CONTROLLERS
 #define MAX_RCV_CONTROLLERS 10
+#endif
 
 fsbus_handle next_handle;
 fsbus_block_t blocks[MAX_RCV_CONTROLLERS]; 
 
+/*
+ * The block for each CID, so a frame start finds its controller straight
+ * away. Where two blocks share a CID the first registered wins, as it did
+ * when blocks[] was searched.
+ */
+static fsbus_block_t *fs_cid_map[FS_CID_MAX];
+
+/*
+ * Point the map entry for cid at the first block with that CID, if any
+ */
+static void fs_cid_map_update(uint8_t cid)
+{
+	uint8_t i;
+
+	fs_cid_map[cid] = NULL;
+	for (i = 0; i < next_handle; i++) {
+		if (blocks[i].fs_cid == cid) {
+			fs_cid_map[cid] = &blocks[i];
+			break;
+		}
+	}
+}
+
 fsbus_block_t *fsbus_register(uint8_t cid, uint8_t ctrl_type, void (*update)(fsbus_block_t *fs_blk))
 {
 	fsbus_handle this_handle;
@@ -22,28 +54,52 @@ fsbus_block_t *fsbus_register(uint8_t cid, uint8_t ctrl_type, void (*update)(fsb
 		return NULL;
 	}
 
+	cid &= FS_CID_MAX - 1;
 	this_handle = next_handle;
 	next_handle++;
 	
 	blocks[this_handle].fs_cid = cid;
 	blocks[this_handle].fs_ctrl_type = ctrl_type;
 	blocks[this_handle].fs_callback = update;
+	blocks[this_handle].fs_rcv_len = FS_RCV_SKIP;	// until the first start byte
+
+	if (!fs_cid_map[cid])
+		fs_cid_map[cid] = &blocks[this_handle];
 	
 	//printf("fsbus_register: cid %d, type %d, update 0x%p\n\r", cid, ctrl_type, update);
 	return(&blocks[this_handle]);
 }
 
+#ifndef FSBUS_HOST
+/*
+ * The main loop. Event callbacks queued by the clock interrupt are run
+ * between received bytes.
+ */
 void fsbus_main()
 {
+	unsigned int c;
+
 	while (1) {
-			fsbus_rcv(uart_getc());
+		event_run();
+		lcd_flush();	// send whatever the callbacks drew to the LCD
+
+		c = uart_getc();
+		if (c & UART_NO_DATA)
+			clock_idle();	// nothing to do, sleep until the next interrupt
+		else
+			fsbus_rcv(c);
 	}
 }
+#endif
 
 
 void fsbus_init(void)
 {
+	uint8_t i;
+
 	next_handle = 0;
+	for (i = 0; i < FS_CID_MAX; i++)
+		fs_cid_map[i] = NULL;
 }
 
 /*
@@ -53,12 +109,25 @@ void fsbus_init(void)
  */
 fsbus_block_t *fs_get_blk(uint8_t cid)
 {
-	uint8_t i;
+	return fs_cid_map[cid & (FS_CID_MAX - 1)];
+}
 
-	for (i = 0; i < next_handle; i++) {
-		if (cid == blocks[i].fs_cid) {
-			return &blocks[i];
-		}
-	}
-	return NULL;
+extern uint8_t fs_cid;
+
+/*
+ * A SETCID command has given a block a new CID. A broadcast one (CID 0)
+ * reaches every block and would put them all on the same CID, so that is
+ * ignored. The KAP140 CIDs are fixed anyway.
+ */
+void fsbus_set_cid(fsbus_block_t *fs_blk, uint8_t cid)
+{
+	uint8_t old = fs_blk->fs_cid;
+
+	cid &= FS_CID_MAX - 1;
+	if (fs_cid == 0 || cid == old)
+		return;
+
+	fs_blk->fs_cid = cid;
+	fs_cid_map_update(old);
+	fs_cid_map_update(cid);
 }
@@ -4,10 +4,15 @@
  */
 #include <stdlib.h>
 //#include <stdio.h>
-#include <avr/io.h>
 #include <stdint.h>
+#include <string.h>
+#ifndef FSBUS_HOST
+#include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "uart.h"
+#endif
 #include "fsbus.h"
+#include "fr.h"
 
 
 /*
@@ -24,19 +29,19 @@ uint8_t fs_cid;
 #define FS_DISPLAY_START 	FS_DF_B1_CMD_MASK
 #define FS_DISPLAY_END		0x40
 
-// Lookup table for length of a dataframe for a command
-const static uint8_t fs_rcmd_dflen[6] = { 2, 3, 3, 3, 3, 3 };
 
 /*
- * Receive handler functions
+ * Receive handler functions. Each returns the FS_ERR_* bits for the byte.
  */
-void fs_rcv_dio(uint8_t c, fsbus_block_t *fs_blk);
-void fs_rcv_display(uint8_t c, fsbus_block_t *fs_blk);
+uint8_t fs_rcv_dio(uint8_t c, fsbus_block_t *fs_blk);
+uint8_t fs_rcv_display(uint8_t c, fsbus_block_t *fs_blk);
 
 /*
  * Receive handler functions pointer table
  */
-static void (*fs_rcv_func[])(uint8_t c, fsbus_block_t *fs_blk) = { fs_rcv_dio, fs_rcv_display, NULL };
+static uint8_t (*fs_rcv_func[])(uint8_t c, fsbus_block_t *fs_blk) = { fs_rcv_dio, fs_rcv_display, NULL };
+
+volatile fsbus_errors_t fsbus_errors;
 
 #define FS_RCMD_A_OUT_0		80
 #define FS_RCMD_A_OUT_7		87
@@ -53,23 +58,83 @@ static void (*fs_rcv_func[])(uint8_t c, fsbus_block_t *fs_blk) = { fs_rcv_dio, f
 #define FS_RCMD_D_OUTBYTE2	122
 #define FS_RCMD_D_OUTBYTE3	123
 
+/*
+ * Dataframe length for each R-command, a nibble per controller type (DIO in
+ * the bottom, display in the top). 0 is a command that type doesn't take,
+ * and the frame is dropped as unknown.
+ */
+#define FS_LEN(dio, display)	((display) << 4 | (dio))
+
+static const uint8_t fs_rcmd_len[256] PROGMEM = {
+	[FS_RCMD_A_OUT_0 ... FS_RCMD_A_OUT_7]			= FS_LEN(3, 0),
+	[FS_RCMD_D_OUTBIT0_0 ... FS_RCMD_D_OUTBIT3_7]	= FS_LEN(2, 0),
+	[FS_RCMD_D_OUTBYTE0 ... FS_RCMD_D_OUTBYTE3]		= FS_LEN(3, 0),
+	[FS_RCMD_RESET]									= FS_LEN(2, 2),
+	[FS_RCMD_SETCID ... FS_RCMD_SETBASEBRIGHT]		= FS_LEN(3, 3),
+};
+
+#define FS_RCMD_LEN(rcmd, type)	((pgm_read_byte(&fs_rcmd_len[(rcmd)]) >> ((type) * 4)) & 0x0f)
+
+/*
+ * The start of a dataframe, for either type. Returns FS_ERR_FRAMING if it
+ * cut short the frame before.
+ */
+static uint8_t fs_rcv_start(fsbus_block_t *blk)
+{
+	uint8_t err = blk->fs_rcv_len < FS_RCV_DONE ? FS_ERR_FRAMING : 0;
+
+	blk->fs_rcv_len = 0;
+	blk->fs_rcmd = 0;
+	blk->fs_rcmd_len = 0;
+	blk->fs_rcmd_v = 0;
+
+	return err;
+}
+
+/*
+ * A byte that isn't a start byte. Returns 1 if it's been put in the buffer,
+ * 0 with the error bits in *err if it's been thrown away: the frame is
+ * already complete (one framing error, then quietly up to the next start
+ * byte) or the buffer is full.
+ */
+static uint8_t fs_rcv_data(uint8_t c, fsbus_block_t *blk, uint8_t *err)
+{
+	if (blk->fs_rcv_len >= FS_RCV_DONE) {
+		if (blk->fs_rcv_len == FS_RCV_DONE)
+			*err = FS_ERR_FRAMING;
+		blk->fs_rcv_len = FS_RCV_SKIP;
+		return 0;
+	}
+
+	if (blk->fs_rcv_len == sizeof(blk->fs_rcv_buf)) {
+		*err = FS_ERR_OVERRUN;
+		blk->fs_rcv_len = FS_RCV_SKIP;
+		return 0;
+	}
+
+	blk->fs_rcv_buf[blk->fs_rcv_len++] = c;
+	return 1;
+}
+
 /*
  * This function is the Digital I/O controller receive routine.
  */
-void fs_rcv_dio(uint8_t c, fsbus_block_t *blk)
+uint8_t fs_rcv_dio(uint8_t c, fsbus_block_t *blk)
 {
+	uint8_t err = 0;
+
 //	printf("fs_rcv_dio(%d) enter\n\r", c);
 
  	if (c & FS_DF_START) {
 //		printf("fs_rcv_dio() got data frame start\n\r");
 
-		blk->fs_rcv_len = 0;
- 		blk->fs_rcmd = (c & FS_DF_B1_CMD_MASK) << 7 ; 
- 		blk->fs_rcmd_len = 0; // Minimum length
+		err = fs_rcv_start(blk);
+		blk->fs_rcmd = (c & FS_DF_B1_CMD_MASK) << 6;	// Bit 7 of the command
 		blk->fs_rcmd_v = c & FS_DF_B1_V0;	// Get the LSB of the value 
- 	}
-	blk->fs_rcv_buf[blk->fs_rcv_len] = c;
-	blk->fs_rcv_len++;
+		blk->fs_rcv_buf[blk->fs_rcv_len++] = c;
+ 	} else if (!fs_rcv_data(c, blk, &err)) {
+		return err;
+	}
 	
 	//printf("fs_rcv_dio: fs_rcv_len %d, exp len %d\n\r", fs_blk->fs_rcv_len, fs_blk->fs_rcmd_len);
 
@@ -79,15 +144,11 @@ void fs_rcv_dio(uint8_t c, fsbus_block_t *blk)
 		blk->fs_rcmd |= c & FS_DF_B2_CMD_MASK;
 		
 		/* Get the expected length */
-		if (blk->fs_rcmd >= 	FS_RCMD_RESET && blk->fs_rcmd <= FS_RCMD_SETBASEBRIGHT)
-			blk->fs_rcmd_len = fs_rcmd_dflen[blk->fs_rcmd - FS_RCMD_RESET];
-		else if (blk->fs_rcmd >= FS_RCMD_A_OUT_0 && blk->fs_rcmd <= FS_RCMD_A_OUT_7)
-			blk->fs_rcmd_len = 3;
-		else if (blk->fs_rcmd >= FS_RCMD_D_OUTBIT0_0 && blk->fs_rcmd <= FS_RCMD_D_OUTBIT3_7)
-			blk->fs_rcmd_len = 2;
-		else if (blk->fs_rcmd >= FS_RCMD_D_OUTBYTE0 && blk->fs_rcmd <= FS_RCMD_D_OUTBYTE3)
-			blk->fs_rcmd_len = 3;	
-
+		blk->fs_rcmd_len = FS_RCMD_LEN(blk->fs_rcmd, FS_CTRL_DIO);
+		if (!blk->fs_rcmd_len) {
+			blk->fs_rcv_len = FS_RCV_SKIP;
+			return err | FS_ERR_UNKNOWN;
+		}
 
 		//printf("fs_rcv_dio: Got 2nd byte, command = %d, exp len = %d\n\r", blk->fs_rcmd, blk->fs_rcmd_len);
 	}
@@ -102,26 +163,47 @@ void fs_rcv_dio(uint8_t c, fsbus_block_t *blk)
 		fsbus_dio_decode(blk);
 		if (blk->fs_callback)
 			(*blk->fs_callback)(blk);
+		blk->fs_rcv_len = FS_RCV_DONE;
 	}
 	
 //	printf("fs_rcv_dio exit\n\r");
+	return err;
 }
 
 
+/*
+ * The sim sends the same display frames over and over. Returns 1 if this
+ * one is the same as the last, which leaves nothing to decode and nothing
+ * to redraw, otherwise remembers it.
+ */
+static uint8_t fs_rcv_display_same(fsbus_block_t *blk)
+{
+	fsbus_display_t *dp = &blk->fs_display;
+
+	if (blk->fs_rcv_len == dp->fs_last_len && !memcmp(blk->fs_rcv_buf, dp->fs_last, blk->fs_rcv_len)) {
+		dp->fs_suppressed++;
+		return 1;
+	}
+
+	memcpy(dp->fs_last, blk->fs_rcv_buf, blk->fs_rcv_len);
+	dp->fs_last_len = blk->fs_rcv_len;
+	return 0;
+}
+
 /*
  * This function is the display controller receive routine.
  */
-void fs_rcv_display(uint8_t c, fsbus_block_t *blk)
+uint8_t fs_rcv_display(uint8_t c, fsbus_block_t *blk)
 {
+	uint8_t err = 0;
+
 //	printf("fs_rcv_display(%d) enter\n\r", c);
 
  	if (c & FS_DF_START) {
 //		printf("fs_rcv_display() got data frame start\n\r");
 
-		blk->fs_rcv_len = 0;
- 		blk->fs_rcmd = 0;
- 		blk->fs_rcmd_len = 0;
- 		blk->fs_rcmd_v = 0;
+		err = fs_rcv_start(blk);
+		blk->fs_rcv_buf[blk->fs_rcv_len++] = c;
 
  		if ((c & FS_DISPLAY_START) == 0) {
 			// We have a display dataframe
@@ -130,9 +212,13 @@ void fs_rcv_display(uint8_t c, fsbus_block_t *blk)
  		} else {
  			blk->fs_rcmd_v = c & FS_DF_B1_V0;	// Get the LSB of the value 
 		}
+
+		// FS_DISPLAY_END is also a CID bit in a start byte, so look no further
+		return err;
  	}
-	blk->fs_rcv_buf[blk->fs_rcv_len] = c;
-	blk->fs_rcv_len++;
+
+	if (!fs_rcv_data(c, blk, &err))
+		return err;
  		
 	/* See if we know the command */
 	if (blk->fs_rcv_len == 2 && !blk->fs_rcmd) {
@@ -140,8 +226,11 @@ void fs_rcv_display(uint8_t c, fsbus_block_t *blk)
 		blk->fs_rcmd = (c & FS_DF_B2_CMD_MASK) | 0x80;
 		
 		/* Get the expected length */
-		if (blk->fs_rcmd >= 	FS_RCMD_RESET && blk->fs_rcmd <= FS_RCMD_SETBASEBRIGHT)
-			blk->fs_rcmd_len = fs_rcmd_dflen[blk->fs_rcmd - FS_RCMD_RESET];
+		blk->fs_rcmd_len = FS_RCMD_LEN(blk->fs_rcmd, FS_CTRL_DISPLAY);
+		if (!blk->fs_rcmd_len) {
+			blk->fs_rcv_len = FS_RCV_SKIP;
+			return err | FS_ERR_UNKNOWN;
+		}
 	}
  		
 	/* See if we have received a complete command */
@@ -151,33 +240,52 @@ void fs_rcv_display(uint8_t c, fsbus_block_t *blk)
 		if (blk->fs_rcmd_len == 3)
 			blk->fs_rcmd_v |= (c & FS_DF_B3_V1_7) << 1;
 //		printf("fs_rcv_display() got complete command (%d) callback %p\n\r", blk->fs_rcmd, blk->fs_callback);
-		fsbus_display_decode(blk);
-		if (blk->fs_callback)
-			(*blk->fs_callback)(blk);
+		if (!fs_rcv_display_same(blk)) {
+			fsbus_display_decode(blk);
+			if (blk->fs_callback)
+				(*blk->fs_callback)(blk);
+		}
+		blk->fs_rcv_len = FS_RCV_DONE;
 	}
 	
 	/* Check if we are receiving a display dataframe ... and it's now complete */
 	
 	if (blk->fs_rcmd == FS_RCMD_DISPLAY && (c & FS_DISPLAY_END)) {
+		if (blk->fs_rcv_len != FS_DISPLAY_LEN) {
+			// Too short, the digits would be left over from the last one
+			blk->fs_rcv_len = FS_RCV_SKIP;
+			return err | FS_ERR_FRAMING;
+		}
+
 		// It's here!
 //		printf("fs_rcv_display() got complete FS_RCMD_DISPLAY command (%d) callback %p\n\r", blk->fs_rcmd, blk->fs_callback);
-		fsbus_display_decode(blk);
-		if (blk->fs_callback)
-			(*blk->fs_callback)(blk);
+		if (!fs_rcv_display_same(blk)) {
+			fsbus_display_decode(blk);
+			if (blk->fs_callback)
+				(*blk->fs_callback)(blk);
+		}
+		blk->fs_rcv_len = FS_RCV_DONE;
 	}
 //	printf("fs_rcv_display() exit\n\r");
+	return err;
 }
 
 extern fsbus_handle next_handle;
 extern fsbus_block_t blocks[];
 
-void fsbus_rcv_all(uint8_t c)
+/*
+ * A broadcast byte, to every controller. A broadcast command that only one
+ * type takes is unknown to the rest, so that isn't counted.
+ */
+uint8_t fsbus_rcv_all(uint8_t c)
 {
-	uint8_t i;
+	uint8_t i, err = 0;
 
 	for (i = 0; i < next_handle; i++) {
-		(*fs_rcv_func[blocks[i].fs_ctrl_type])(c, &blocks[i]);
+		err |= (*fs_rcv_func[blocks[i].fs_ctrl_type])(c, &blocks[i]);
 	}
+
+	return err & ~FS_ERR_UNKNOWN;
 }
 
 static fsbus_block_t *fs_blk = NULL;
@@ -187,6 +295,7 @@ static fsbus_block_t *fs_blk = NULL;
  */
 void fsbus_rcv(uint8_t c)
 {
+	uint8_t err = 0;
 
 //	printf("fsbus_rcv(0x%x) enter\n\r", c);
 
@@ -202,17 +311,28 @@ void fsbus_rcv(uint8_t c)
 	if (fs_cid == 0) {
 		// Post to all our registered controllers
 //		printf("fsbus_rcv() Posting character to all registered controllers, fs_cid = %d, fs_blk = %p\n\r", fs_cid, fs_blk);
-		fsbus_rcv_all(c);
+		err = fsbus_rcv_all(c);
 	} else {
 		if (fs_blk) {
 //			printf("fsbus_rcv() Posting character\n\r");
 
-			(*fs_rcv_func[fs_blk->fs_ctrl_type])(c, fs_blk);
+			err = (*fs_rcv_func[fs_blk->fs_ctrl_type])(c, fs_blk);
 		} else {
 //			printf("fsbus_rcv() No controller for this cid, fs_cid = %d, fs_blk = %p\n\r", fs_cid, fs_blk);
 		}
 	}
 
+	if (err) {
+		if (err & FS_ERR_FRAMING)
+			fsbus_errors.fe_framing++;
+		if (err & FS_ERR_OVERRUN)
+			fsbus_errors.fe_overrun++;
+		if (err & FS_ERR_UNKNOWN)
+			fsbus_errors.fe_unknown++;
+	}
+
+	fr_log(FR_RCV, c, fs_cid);
+
 //	printf("fsbus_rcv() exit\n\r");
 }
 
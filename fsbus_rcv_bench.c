@@ -0,0 +1,129 @@
+/*
+ * Time fsbus_rcv() with a number of controllers registered, looking each
+ * frame's controller up through fs_cid_map against the old scan of
+ * blocks[]. This is a host program, not part of the firmware, it builds
+ * fsbus_rcv.c and fsbus_main.c with the AVR parts stubbed out:
+ *
+ *	cc -std=gnu99 -O2 -o fsbus_rcv_bench fsbus_rcv_bench.c
+ *	fsbus_rcv_bench 8 16 31
+ *
+ * A DIO controller is registered on each of CIDs 1 up, and 3 byte DOUT
+ * frames go to each in turn. MAX_RCV_CONTROLLERS is built as 31, one for
+ * every CID but the broadcast one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define FSBUS_HOST
+#define FR_HOST
+#define MAX_RCV_CONTROLLERS	(FS_CID_MAX - 1)
+
+#define PROGMEM
+#define pgm_read_byte(p)		(*(const uint8_t *)(p))
+#define fr_log(id, arg, data)	do { } while (0)
+
+#include "fsbus_rcv.c"
+#define fs_get_blk fs_get_blk_map		// fsbus_main.c's, called from the one below
+#include "fsbus_main.c"
+#undef fs_get_blk
+
+#define BENCH_BYTES	(64L << 20)
+
+static uint8_t bench_scan;
+static uint32_t bench_decodes;
+
+/*
+ * The baseline fs_get_blk()
+ */
+static fsbus_block_t *fs_get_blk_scan(uint8_t cid)
+{
+	int i;
+
+	for (i = 0; i < next_handle; i++) {
+		if (blocks[i].fs_cid == cid)
+			return &blocks[i];
+	}
+	return NULL;
+}
+
+fsbus_block_t *fs_get_blk(uint8_t cid)
+{
+	return bench_scan ? fs_get_blk_scan(cid) : fs_get_blk_map(cid);
+}
+
+void fsbus_dio_decode(__attribute__((unused)) fsbus_block_t *blk)
+{
+	bench_decodes++;
+}
+
+void fsbus_display_decode(__attribute__((unused)) fsbus_block_t *blk)
+{
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * MB/s through fsbus_rcv() of frames to n controllers
+ */
+static double bench_run(int n, uint8_t scan)
+{
+	static uint8_t buf[FS_CID_MAX * 3];
+	double t;
+	long i;
+	int j, len;
+
+	fsbus_init();
+	for (j = 1; j <= n; j++)
+		fsbus_register(j, FS_CTRL_DIO, NULL);
+
+	for (len = 0, j = 1; j <= n; j++) {
+		buf[len++] = FS_DF_START | j << 2 | (j & FS_DF_B1_V0);
+		buf[len++] = FS_RCMD_D_OUTBYTE0 + j % 4;
+		buf[len++] = j;
+	}
+
+	bench_scan = scan;
+	bench_decodes = 0;
+	t = bench_now();
+	for (i = 0; i < BENCH_BYTES; i += len) {
+		for (j = 0; j < len; j++)
+			fsbus_rcv(buf[j]);
+	}
+	t = bench_now() - t;
+
+	if (bench_decodes != i / 3) {
+		fprintf(stderr, "%u frames decoded of %ld\n", bench_decodes, i / 3);
+		exit(1);
+	}
+	return i / t / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, n;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: fsbus_rcv_bench controllers ...\n");
+		return 1;
+	}
+
+	printf("controllers  scan MB/s  map MB/s\n");
+	for (i = 1; i < argc; i++) {
+		n = atoi(argv[i]);
+		if (n < 1 || n > MAX_RCV_CONTROLLERS) {
+			fprintf(stderr, "controllers must be 1 to %d\n", MAX_RCV_CONTROLLERS);
+			return 1;
+		}
+		printf("%11d %10.1f %9.1f\n", n, bench_run(n, 1), bench_run(n, 0));
+	}
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Fuzz the FSBUS receive parser in fsbus_rcv.c. This is a host program,
+ * not part of the firmware, it builds fsbus_rcv.c with the AVR parts
+ * stubbed out. With libFuzzer:
+ *
+ *	clang -std=gnu99 -g -O1 -fsanitize=fuzzer,address,undefined -o fsbus_rcv_fuzz fsbus_rcv_fuzz.c
+ *	fsbus_rcv_fuzz [corpus]
+ *
+ * or without it, on random streams for a number of seconds:
+ *
+ *	cc -std=gnu99 -g -O1 -fsanitize=address,undefined -DFUZZ_STANDALONE -o fsbus_rcv_fuzz fsbus_rcv_fuzz.c
+ *	fsbus_rcv_fuzz [seconds [seed]]
+ *
+ * Each input is fed a byte at a time to fsbus_rcv(), with DIO and display
+ * controllers on eight CIDs (16 and 17 among them, as on the KAP140).
+ * After every byte each block must be inside a frame within fs_rcv_buf or
+ * outside one, and nothing may have been written over its fs_callback. A
+ * decoded display dataframe must be FS_DISPLAY_LEN bytes. Parse throughput
+ * and the error counts are printed at exit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define FSBUS_HOST
+#define FR_HOST
+
+#define PROGMEM
+#define pgm_read_byte(p)		(*(const uint8_t *)(p))
+#define fr_log(id, arg, data)	do { } while (0)
+
+#include "fsbus_rcv.c"
+
+#define FUZZ_BLOCKS	8
+
+static const uint8_t fuzz_cid[FUZZ_BLOCKS] = { 1, 2, 5, 9, 16, 17, 22, 31 };
+
+fsbus_handle next_handle;
+fsbus_block_t blocks[FUZZ_BLOCKS];
+
+static fsbus_block_t *fuzz_map[FS_CID_MAX];
+
+static uint64_t fuzz_bytes, fuzz_decodes, fuzz_dio_common;
+static double fuzz_time;
+
+fsbus_block_t *fs_get_blk(uint8_t cid)
+{
+	return fuzz_map[cid & (FS_CID_MAX - 1)];
+}
+
+static void fuzz_check_decode(fsbus_block_t *blk)
+{
+	if (blk->fs_rcv_len > sizeof(blk->fs_rcv_buf))
+		__builtin_trap();
+	if (blk->fs_rcmd == FS_RCMD_DISPLAY && blk->fs_rcv_len != FS_DISPLAY_LEN)
+		__builtin_trap();
+	fuzz_decodes++;
+}
+
+void fsbus_dio_decode(fsbus_block_t *blk)
+{
+	fuzz_check_decode(blk);
+	if (blk->fs_rcmd >= FS_RCMD_RESET)
+		fuzz_dio_common++;
+}
+
+void fsbus_display_decode(fsbus_block_t *blk)
+{
+	fuzz_check_decode(blk);
+}
+
+static void fuzz_callback(__attribute__((unused)) fsbus_block_t *blk)
+{
+}
+
+static double fuzz_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fuzz_report(void)
+{
+	fprintf(stderr, "fsbus_rcv: %llu bytes in %.2fs, %.1f MB/s, %llu decodes (%llu DIO common commands)\n",
+		(unsigned long long)fuzz_bytes, fuzz_time,
+		fuzz_time > 0 ? fuzz_bytes / fuzz_time / 1e6 : 0.0,
+		(unsigned long long)fuzz_decodes, (unsigned long long)fuzz_dio_common);
+	fprintf(stderr, "fsbus_rcv: framing %u, overrun %u, unknown %u\n",
+		fsbus_errors.fe_framing, fsbus_errors.fe_overrun, fsbus_errors.fe_unknown);
+}
+
+static void fuzz_init(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < FUZZ_BLOCKS; i++) {
+		blocks[i].fs_cid = fuzz_cid[i];
+		blocks[i].fs_ctrl_type = i & 1 ? FS_CTRL_DISPLAY : FS_CTRL_DIO;
+		blocks[i].fs_rcv_len = FS_RCV_SKIP;
+		blocks[i].fs_callback = fuzz_callback;
+		fuzz_map[fuzz_cid[i]] = &blocks[i];
+	}
+	next_handle = FUZZ_BLOCKS;
+	atexit(fuzz_report);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static uint8_t ready;
+	double t;
+	size_t n;
+	uint8_t i;
+
+	if (!ready) {
+		fuzz_init();
+		ready = 1;
+	}
+
+	t = fuzz_now();
+	for (n = 0; n < size; n++) {
+		fsbus_rcv(data[n]);
+
+		for (i = 0; i < FUZZ_BLOCKS; i++) {
+			if (blocks[i].fs_rcv_len > sizeof(blocks[i].fs_rcv_buf) &&
+					blocks[i].fs_rcv_len < FS_RCV_DONE)
+				__builtin_trap();
+			if (blocks[i].fs_callback != fuzz_callback)
+				__builtin_trap();
+		}
+	}
+	fuzz_time += fuzz_now() - t;
+	fuzz_bytes += size;
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+/*
+ * Random input, mostly start bytes for the registered CIDs followed by a
+ * few data bytes so that some frames get through, with noise in between
+ */
+static size_t fuzz_input(uint8_t *buf, size_t size)
+{
+	size_t n = 0;
+	int i, len;
+
+	while (n < size) {
+		if (rand() % 8) {
+			buf[n++] = FS_DF_START | fuzz_cid[rand() % FUZZ_BLOCKS] << 2 | (rand() & 0x03);
+			len = rand() % 7;
+			for (i = 0; i < len && n < size; i++)
+				buf[n++] = rand() & 0x7f;
+		} else {
+			buf[n++] = rand();
+		}
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	double secs = argc > 1 ? atof(argv[1]) : 5;
+	uint8_t buf[4096];
+	double end;
+
+	srand(argc > 2 ? atoi(argv[2]) : 1);
+
+	end = fuzz_now() + secs;
+	while (fuzz_now() < end)
+		LLVMFuzzerTestOneInput(buf, fuzz_input(buf, 1 + rand() % sizeof(buf)));
+	return 0;
+}
+#endif
@@ -0,0 +1,250 @@
+/*
+ * Check the table driven frame lengths in fsbus_rcv.c against the range
+ * comparisons they replaced. This is a host program, not part of the
+ * firmware, it builds fsbus_rcv.c with the AVR parts stubbed out:
+ *
+ *	cc -std=gnu99 -O2 -o fsbus_rcv_test fsbus_rcv_test.c
+ *	fsbus_rcv_test [frames [seed]]
+ *
+ * Every R-command is looked up both ways for each controller type. Then
+ * random streams of frames go through the old receive routines (as in the
+ * baseline, less the decode) and the new ones, and the frames each hands
+ * on for decoding must be the same.
+ *
+ * The streams are well formed, since the old routines run off the end of
+ * fs_rcv_buf on anything else. Frames for commands neither type takes are
+ * in them. So are repeated display frames, with the repeat suppression
+ * turned off as it isn't part of the length decode. CIDs of 16 and up are
+ * left out: they set FS_DISPLAY_END in the start byte, which the old
+ * display routine took for the end of the frame. So is display command 72,
+ * which the old routine took for a display dataframe since 72 | 0x80 is
+ * FS_RCMD_DISPLAY.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FSBUS_HOST
+#define FR_HOST
+
+#define PROGMEM
+#define pgm_read_byte(p)		(*(const uint8_t *)(p))
+#define fr_log(id, arg, data)	do { } while (0)
+
+#include "fsbus_rcv.c"
+
+fsbus_handle next_handle;
+fsbus_block_t blocks[1];
+
+fsbus_block_t *fs_get_blk(__attribute__((unused)) uint8_t cid)
+{
+	return NULL;
+}
+
+/*
+ * A frame handed on for decoding
+ */
+typedef struct test_frame_s {
+	uint8_t		tf_type;
+	uint8_t		tf_rcmd;
+	uint8_t		tf_rcmd_v;
+	uint8_t		tf_len;
+	uint8_t		tf_buf[6];
+} test_frame_t;
+
+static test_frame_t test_old, test_new;
+static int test_old_n, test_new_n;
+
+static void test_record(test_frame_t *f, int *n, uint8_t type, fsbus_block_t *blk)
+{
+	memset(f, 0, sizeof(*f));
+	f->tf_type = type;
+	f->tf_rcmd = blk->fs_rcmd;
+	f->tf_rcmd_v = blk->fs_rcmd_v;
+	f->tf_len = blk->fs_rcv_len;
+	memcpy(f->tf_buf, blk->fs_rcv_buf, blk->fs_rcv_len);
+	(*n)++;
+}
+
+void fsbus_dio_decode(fsbus_block_t *blk)
+{
+	test_record(&test_new, &test_new_n, FS_CTRL_DIO, blk);
+}
+
+void fsbus_display_decode(fsbus_block_t *blk)
+{
+	test_record(&test_new, &test_new_n, FS_CTRL_DISPLAY, blk);
+}
+
+/*
+ * The baseline length lookups
+ */
+static const uint8_t old_rcmd_dflen[6] = { 2, 3, 3, 3, 3, 3 };
+
+static uint8_t old_dio_len(uint8_t rcmd)
+{
+	if (rcmd >= FS_RCMD_RESET && rcmd <= FS_RCMD_SETBASEBRIGHT)
+		return old_rcmd_dflen[rcmd - FS_RCMD_RESET];
+	else if (rcmd >= FS_RCMD_A_OUT_0 && rcmd <= FS_RCMD_A_OUT_7)
+		return 3;
+	else if (rcmd >= FS_RCMD_D_OUTBIT0_0 && rcmd <= FS_RCMD_D_OUTBIT3_7)
+		return 2;
+	else if (rcmd >= FS_RCMD_D_OUTBYTE0 && rcmd <= FS_RCMD_D_OUTBYTE3)
+		return 3;
+	return 0;
+}
+
+static uint8_t old_display_len(uint8_t rcmd)
+{
+	if (rcmd >= FS_RCMD_RESET && rcmd <= FS_RCMD_SETBASEBRIGHT)
+		return old_rcmd_dflen[rcmd - FS_RCMD_RESET];
+	return 0;
+}
+
+/*
+ * The baseline receive routines, decoding into test_old. The DIO one takes
+ * bit 7 of the command from the start byte with a shift of 6, as fsbus_rcv.c
+ * now does. The baseline shifted by 7, which dropped the bit, so the common
+ * commands (RESET to SETBASEBRIGHT) never reached a DIO controller. That is
+ * a fix rather than part of the length decode, so both sides have it here.
+ */
+static void old_rcv_dio(uint8_t c, fsbus_block_t *blk)
+{
+	if (c & FS_DF_START) {
+		blk->fs_rcv_len = 0;
+		blk->fs_rcmd = (c & FS_DF_B1_CMD_MASK) << 6;
+		blk->fs_rcmd_len = 0;
+		blk->fs_rcmd_v = c & FS_DF_B1_V0;
+	}
+	blk->fs_rcv_buf[blk->fs_rcv_len] = c;
+	blk->fs_rcv_len++;
+
+	if (blk->fs_rcv_len == 2) {
+		blk->fs_rcmd |= c & FS_DF_B2_CMD_MASK;
+		blk->fs_rcmd_len = old_dio_len(blk->fs_rcmd);
+	}
+
+	if (blk->fs_rcmd_len && blk->fs_rcmd_len == blk->fs_rcv_len) {
+		if (blk->fs_rcmd_len == 3)
+			blk->fs_rcmd_v |= (c & FS_DF_B3_V1_7) << 1;
+		test_record(&test_old, &test_old_n, FS_CTRL_DIO, blk);
+	}
+}
+
+static void old_rcv_display(uint8_t c, fsbus_block_t *blk)
+{
+	if (c & FS_DF_START) {
+		blk->fs_rcv_len = 0;
+		blk->fs_rcmd = 0;
+		blk->fs_rcmd_len = 0;
+		blk->fs_rcmd_v = 0;
+
+		if ((c & FS_DISPLAY_START) == 0)
+			blk->fs_rcmd = FS_RCMD_DISPLAY;
+		else
+			blk->fs_rcmd_v = c & FS_DF_B1_V0;
+	}
+	blk->fs_rcv_buf[blk->fs_rcv_len] = c;
+	blk->fs_rcv_len++;
+
+	if (blk->fs_rcv_len == 2 && !blk->fs_rcmd) {
+		blk->fs_rcmd = (c & FS_DF_B2_CMD_MASK) | 0x80;
+		blk->fs_rcmd_len = old_display_len(blk->fs_rcmd);
+	}
+
+	if (blk->fs_rcmd_len && blk->fs_rcmd_len == blk->fs_rcv_len) {
+		if (blk->fs_rcmd_len == 3)
+			blk->fs_rcmd_v |= (c & FS_DF_B3_V1_7) << 1;
+		test_record(&test_old, &test_old_n, FS_CTRL_DISPLAY, blk);
+	}
+
+	if (blk->fs_rcmd == FS_RCMD_DISPLAY && (c & FS_DISPLAY_END))
+		test_record(&test_old, &test_old_n, FS_CTRL_DISPLAY, blk);
+}
+
+/*
+ * A random well formed frame for a controller type, returns its length
+ */
+static int test_frame(uint8_t type, uint8_t *f)
+{
+	int len, i;
+
+	f[0] = FS_DF_START | (rand() % 16) << 2 | (rand() & (FS_DF_B1_CMD_MASK | FS_DF_B1_V0));
+
+	if (type == FS_CTRL_DISPLAY && !(f[0] & FS_DISPLAY_START)) {
+		for (i = 1; i < FS_DISPLAY_LEN; i++)
+			f[i] = rand() & ~(FS_DF_START | FS_DISPLAY_END);
+		f[FS_DISPLAY_LEN - 1] |= FS_DISPLAY_END;
+		return FS_DISPLAY_LEN;
+	}
+
+	do {
+		f[1] = rand() & FS_DF_B2_CMD_MASK;
+	} while (type == FS_CTRL_DISPLAY && (f[1] | 0x80) == FS_RCMD_DISPLAY);
+	if (type == FS_CTRL_DIO)
+		len = old_dio_len((f[0] & FS_DF_B1_CMD_MASK) << 6 | f[1]);
+	else
+		len = old_display_len(f[1] | 0x80);
+	if (!len)
+		len = 2 + rand() % 2;		// Unknown, as long as a known one could be
+	if (len == 3)
+		f[2] = rand() & FS_DF_B3_V1_7;
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	long frames = argc > 1 ? atol(argv[1]) : 1000000;
+	unsigned seed = argc > 2 ? atoi(argv[2]) : 1;
+	fsbus_block_t old_blk, new_blk;
+	uint8_t f[FS_DISPLAY_LEN], type;
+	int rcmd, len, i, fails = 0;
+	long n;
+
+	for (rcmd = 0; rcmd < 256; rcmd++) {
+		if (FS_RCMD_LEN(rcmd, FS_CTRL_DIO) != old_dio_len(rcmd) ||
+				FS_RCMD_LEN(rcmd, FS_CTRL_DISPLAY) != old_display_len(rcmd)) {
+			printf("rcmd %d: dio %d was %d, display %d was %d\n", rcmd,
+				FS_RCMD_LEN(rcmd, FS_CTRL_DIO), old_dio_len(rcmd),
+				FS_RCMD_LEN(rcmd, FS_CTRL_DISPLAY), old_display_len(rcmd));
+			fails++;
+		}
+	}
+
+	srand(seed);
+	for (type = FS_CTRL_DIO; type <= FS_CTRL_DISPLAY; type++) {
+		memset(&old_blk, 0, sizeof(old_blk));
+		memset(&new_blk, 0, sizeof(new_blk));
+		old_blk.fs_ctrl_type = new_blk.fs_ctrl_type = type;
+
+		for (n = 0; n < frames && fails < 10; n++) {
+			len = test_frame(type, f);
+			test_old_n = test_new_n = 0;
+			new_blk.fs_display.fs_last_len = 0;		// No repeat suppression
+
+			for (i = 0; i < len; i++) {
+				if (type == FS_CTRL_DIO) {
+					old_rcv_dio(f[i], &old_blk);
+					fs_rcv_dio(f[i], &new_blk);
+				} else {
+					old_rcv_display(f[i], &old_blk);
+					fs_rcv_display(f[i], &new_blk);
+				}
+			}
+
+			if (test_old_n != test_new_n || (test_old_n && memcmp(&test_old, &test_new, sizeof(test_old)))) {
+				printf("%s frame %ld:", type == FS_CTRL_DIO ? "dio" : "display", n);
+				for (i = 0; i < len; i++)
+					printf(" %02x", f[i]);
+				printf(", old decoded %d (rcmd %d v %d), new %d (rcmd %d v %d)\n",
+					test_old_n, test_old.tf_rcmd, test_old.tf_rcmd_v,
+					test_new_n, test_new.tf_rcmd, test_new.tf_rcmd_v);
+				fails++;
+			}
+		}
+	}
+
+	printf("%ld frames per type, seed %u: %s\n", frames, seed, fails ? "FAILED" : "ok");
+	return fails != 0;
+}
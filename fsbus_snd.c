@@ -3,7 +3,9 @@
  */
 #include <stdlib.h>
 //#include <stdio.h>
+#ifndef FSBUS_HOST
 #include <avr/io.h>
+#endif
 #include <stdint.h>
 #include "uart.h"
 #include "fsbus.h"
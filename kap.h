@@ -3,4 +3,9 @@
 
 void kap_init(void);
 
+uint8_t kap_state_line(uint8_t n, char *buf, uint8_t size);
+uint8_t kap_state_set(const char *name, int32_t value);
+void kap_pid_get(int16_t *p, int16_t *i, int16_t *d);
+void kap_pid_set(int16_t p, int16_t i, int16_t d);
+
 #endif
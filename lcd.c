@@ -13,7 +13,7 @@
        added 4-bit I/O mode, improved and optimized code.
 
        Library can be operated in memory mapped mode (LCD_IO_MODE=0) or in 
-       4-bit IO port mode (LCD_IO_MODE=1). 8-bit IO port mode not supported.
+       IO port mode (LCD_IO_MODE=1), 4-bit or, with LCD_BUS_8BIT, 8-bit.
        
        Memory mapped mode compatible with Kanda STK200, but supports also
        generation of R/W signal through A8 address line.
@@ -23,8 +23,12 @@
        
 *****************************************************************************/
 #include <inttypes.h>
+#ifndef LCD_HOST
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#endif
+#include <string.h>
 #include "lcd.h"
 
 
@@ -42,8 +46,46 @@
 #endif
 
 
+#if LCD_SHADOW
+/*
+ * With the R/W line hardwired every command is a fixed 5ms and every data
+ * byte 1ms, so it is cheaper to resend up to four unchanged characters than
+ * to start a new run with an address set. With the busy flag the two cost
+ * about the same and runs are only joined when they touch.
+ */
+#if LCD_RW_HARDWIRED
+#define LCD_FLUSH_GAP   4
+#else
+#define LCD_FLUSH_GAP   0
+#endif
+
+static char lcd_shadow[LCD_LINES][LCD_DISP_LENGTH];  /* what we want on the screen */
+static char lcd_shown[LCD_LINES][LCD_DISP_LENGTH];   /* what the controller has    */
+static uint8_t lcd_x, lcd_y;                         /* cursor into lcd_shadow     */
+static uint8_t lcd_dirty;                            /* lcd_shadow != lcd_shown    */
+
+typedef struct lcd_blink_s {
+    uint8_t     lb_x, lb_y;     /* first character                  */
+    uint8_t     lb_len;         /* characters, 0 if the slot is free */
+    uint8_t     lb_on, lb_off;  /* phase lengths, LCD_BLINK_MS ticks */
+    uint8_t     lb_ticks;       /* ticks into the current phase     */
+    uint8_t     lb_hidden;      /* in the off phase                 */
+} lcd_blink_t;
+
+static lcd_blink_t lcd_blinks[LCD_BLINKS];
+
+static const uint8_t lcd_line_start[] = {
+    LCD_START_LINE1, LCD_START_LINE2, LCD_START_LINE3, LCD_START_LINE4
+};
+#endif
+
+uint32_t lcd_writes;
+
+
 #if LCD_IO_MODE
+#ifndef LCD_HOST
 #define lcd_e_delay()   __asm__ __volatile__( "rjmp 1f\n 1:" );
+#endif
 #define lcd_e_high()    LCD_E_PORT  |=  _BV(LCD_E_PIN);
 #define lcd_e_low()     LCD_E_PORT  &= ~_BV(LCD_E_PIN);
 #define lcd_e_toggle()  toggle_e()
@@ -55,7 +97,7 @@
 #define lcd_rs_low()    LCD_RS_PORT &= ~_BV(LCD_RS_PIN)
 #endif
 
-#if LCD_IO_MODE
+#if LCD_IO_MODE && !LCD_BUS_8BIT
 #if LCD_LINES==1
 #define LCD_FUNCTION_DEFAULT    LCD_FUNCTION_4BIT_1LINE 
 #else
@@ -95,6 +137,7 @@ static void toggle_e(void);
 /*************************************************************************
  delay loop for small accurate delays: 16-bit counter, 4 cycles/loop
 *************************************************************************/
+#ifndef LCD_HOST
 static inline void _delayFourCycles(unsigned int __count)
 {
     if ( __count == 0 )    
@@ -107,6 +150,7 @@ static inline void _delayFourCycles(unsigned int __count)
     	    : "0" (__count)
     	   );
 }
+#endif
 
 
 /************************************************************************* 
@@ -116,6 +160,23 @@ the number of loops is calculated at compile-time from MCU clock frequency
 #define delay(us)  _delayFourCycles( ( ( 1*(XTAL/4000) )*us)/1000 )
 
 
+/*
+ * Instruction execution times from the HD44780 data sheet, which are for
+ * its nominal 270kHz oscillator. Parts run anywhere from 190kHz to 350kHz,
+ * so they are scaled to LCD_FOSC_KHZ, the slowest the display fitted could
+ * be. These pace the writes when the busy flag can't be read, either with
+ * R/W hardwired or from the LCD_ASYNC interrupt.
+ */
+#ifndef LCD_FOSC_KHZ
+#define LCD_FOSC_KHZ    190
+#endif
+#define LCD_T(us)       (((us) * 270UL + LCD_FOSC_KHZ - 1) / LCD_FOSC_KHZ)
+
+#define LCD_EXEC_US     LCD_T(37)       /* most instructions             */
+#define LCD_WRITE_US    (LCD_T(37) + 4) /* data write, and the tADD      */
+#define LCD_CLEAR_US    LCD_T(1520)     /* clear display and return home */
+
+
 #if LCD_IO_MODE
 /* toggle Enable Pin to initiate write */
 static void toggle_e(void)
@@ -124,7 +185,7 @@ static void toggle_e(void)
     lcd_e_delay();
     lcd_e_low();
 #if LCD_RW_HARDWIRED
-	delay(10);
+	delay(1);   /* E cycle time */
 #endif
 }
 #endif
@@ -138,37 +199,19 @@ Input:    data   byte to write to LCD
 Returns:  none
 *************************************************************************/
 #if LCD_IO_MODE
-static void lcd_write(uint8_t data,uint8_t rs) 
+#if !LCD_BUS_8BIT
+/*************************************************************************
+Put the low four bits of nibble on the data lines
+*************************************************************************/
+static inline void lcd_nibble(uint8_t nibble)
 {
-    unsigned char dataBits ;
-
-
-    if (rs) {   /* write data        (RS=1, RW=0) */
-       lcd_rs_high();
-    } else {    /* write instruction (RS=0, RW=0) */
-       lcd_rs_low();
-    }
-#if !LCD_RW_HARDWIRED
-    lcd_rw_low();
-#endif
-
     if ( ( &LCD_DATA0_PORT == &LCD_DATA1_PORT) && ( &LCD_DATA1_PORT == &LCD_DATA2_PORT ) && ( &LCD_DATA2_PORT == &LCD_DATA3_PORT )
       && (LCD_DATA0_PIN == 0) && (LCD_DATA1_PIN == 1) && (LCD_DATA2_PIN == 2) && (LCD_DATA3_PIN == 3) )
     {
         /* configure data pins as output */
         DDR(LCD_DATA0_PORT) |= 0x0F;
 
-        /* output high nibble first */
-        dataBits = LCD_DATA0_PORT & 0xF0;
-        LCD_DATA0_PORT = dataBits |((data>>4)&0x0F);
-        lcd_e_toggle();
-
-        /* output low nibble */
-        LCD_DATA0_PORT = dataBits | (data&0x0F);
-        lcd_e_toggle();
-
-        /* all data pins high (inactive) */
-        LCD_DATA0_PORT = dataBits | 0x0F;
+        LCD_DATA0_PORT = (LCD_DATA0_PORT & 0xF0) | (nibble & 0x0F);
     }
     else
     {
@@ -177,56 +220,233 @@ static void lcd_write(uint8_t data,uint8_t rs)
         DDR(LCD_DATA1_PORT) |= _BV(LCD_DATA1_PIN);
         DDR(LCD_DATA2_PORT) |= _BV(LCD_DATA2_PIN);
         DDR(LCD_DATA3_PORT) |= _BV(LCD_DATA3_PIN);
-        
-        /* output high nibble first */
-        LCD_DATA3_PORT &= ~_BV(LCD_DATA3_PIN);
-        LCD_DATA2_PORT &= ~_BV(LCD_DATA2_PIN);
-        LCD_DATA1_PORT &= ~_BV(LCD_DATA1_PIN);
-        LCD_DATA0_PORT &= ~_BV(LCD_DATA0_PIN);
-    	if(data & 0x80) LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
-    	if(data & 0x40) LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
-    	if(data & 0x20) LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
-    	if(data & 0x10) LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);   
-        lcd_e_toggle();
-        
-        /* output low nibble */
+
         LCD_DATA3_PORT &= ~_BV(LCD_DATA3_PIN);
         LCD_DATA2_PORT &= ~_BV(LCD_DATA2_PIN);
         LCD_DATA1_PORT &= ~_BV(LCD_DATA1_PIN);
         LCD_DATA0_PORT &= ~_BV(LCD_DATA0_PIN);
-    	if(data & 0x08) LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
-    	if(data & 0x04) LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
-    	if(data & 0x02) LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
-    	if(data & 0x01) LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);
-        lcd_e_toggle();        
-        
-        /* all data pins high (inactive) */
-        LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);
-        LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
-        LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
-        LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
+    	if(nibble & 0x08) LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
+    	if(nibble & 0x04) LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
+    	if(nibble & 0x02) LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
+    	if(nibble & 0x01) LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);
     }
+}
+#endif
+
+#if !LCD_ASYNC
+static void lcd_write(uint8_t data,uint8_t rs) 
+{
+    if (rs) {   /* write data        (RS=1, RW=0) */
+       lcd_rs_high();
+    } else {    /* write instruction (RS=0, RW=0) */
+       lcd_rs_low();
+    }
+#if !LCD_RW_HARDWIRED
+    lcd_rw_low();
+#endif
+
+#if LCD_BUS_8BIT
+    /* the whole byte in one go */
+    DDR(LCD_DATA_PORT) = 0xFF;
+    LCD_DATA_PORT = data;
+    lcd_e_toggle();
+#else
+    /* output high nibble first */
+    lcd_nibble(data >> 4);
+    lcd_e_toggle();
+
+    /* output low nibble */
+    lcd_nibble(data);
+    lcd_e_toggle();
+
+    /* all data pins high (inactive) */
+    lcd_nibble(0x0F);
+#endif
+
+    lcd_writes++;
 #if LCD_RW_HARDWIRED
-	if (rs == 0)
-		delay(5000); // 5ms
-	else
-		delay(1000); // 1ms
+    /* no busy flag to wait on, give the instruction its time */
+    if (rs)
+        delay(LCD_WRITE_US);
+    else if (data < 4)          /* clear and home are the only ones below 4 */
+        delay(LCD_CLEAR_US);
+    else
+        delay(LCD_EXEC_US);
 #endif
 }
+#endif
 #else
-#define lcd_write(d,rs) if (rs) *(volatile uint8_t*)(LCD_IO_DATA) = d; else *(volatile uint8_t*)(LCD_IO_FUNCTION) = d;
+#define lcd_write(d,rs) { if (rs) *(volatile uint8_t*)(LCD_IO_DATA) = d; else *(volatile uint8_t*)(LCD_IO_FUNCTION) = d; lcd_writes++; }
 /* rs==0 -> write instruction to LCD_IO_FUNCTION */
 /* rs==1 -> write data to LCD_IO_DATA */
 #endif
 
 
+#if LCD_ASYNC
+#if !LCD_IO_MODE
+#error "LCD_ASYNC needs LCD_IO_MODE"
+#endif
+
+/*
+ * TIMER0 in CTC mode at clk/256 paces the writes, 16us a count at 16MHz.
+ * Each interrupt sends one byte, both nibbles of it without LCD_BUS_8BIT,
+ * then the next byte waits for the controller to finish with this one.
+ */
+#if defined(__AVR_ATmega128__)
+#define LCD_T0_OCR      OCR0
+#define LCD_T0_TIMSK    TIMSK
+#define LCD_T0_TIFR     TIFR
+#define LCD_T0_OCIE     OCIE0
+#define LCD_T0_OCF      OCF0
+#define LCD_T0_VECT     TIMER0_COMP_vect
+#else
+#define LCD_T0_OCR      OCR0A
+#define LCD_T0_TIMSK    TIMSK0
+#define LCD_T0_TIFR     TIFR0
+#define LCD_T0_OCIE     OCIE0A
+#define LCD_T0_OCF      OCF0A
+#define LCD_T0_VECT     TIMER0_COMPA_vect
+#endif
+
+#define LCD_T0_US       (256000000UL / F_CPU)        /* usec per TIMER0 count */
+#define LCD_T0_COUNTS(us)   ((us) / LCD_T0_US + 1)
+
+#if LCD_T0_COUNTS(LCD_CLEAR_US) > 255
+#error "LCD_CLEAR_US is too long for TIMER0 at clk/256"
+#endif
+
+#define LCD_Q_RS        0x100   /* queue entry is data, not an instruction */
+
+static uint16_t lcd_q[LCD_QUEUE];
+static volatile uint8_t lcd_q_head;     /* next free entry, moved by lcd_queue() */
+static volatile uint8_t lcd_q_tail;     /* entry going out, moved by the interrupt */
+static uint16_t lcd_q_counts;           /* TIMER0 counts since the queue was idle */
+
+volatile lcd_stat_t lcd_stat;
+
+/*************************************************************************
+Add a byte to the queue, starting the interrupt if it had stopped. Waits
+if the queue is full.
+*************************************************************************/
+static void lcd_queue(uint8_t data, uint8_t rs)
+{
+    uint8_t head = (lcd_q_head + 1) & (LCD_QUEUE - 1);
+    uint8_t depth, sreg;
+
+    if (head == lcd_q_tail)
+    {
+        lcd_stat.ls_full++;
+        while (head == lcd_q_tail)
+            ;
+    }
+    lcd_q[lcd_q_head] = rs ? data | LCD_Q_RS : data;
+    lcd_q_head = head;
+    lcd_writes++;
+
+    depth = (head - lcd_q_tail) & (LCD_QUEUE - 1);
+    if (depth > lcd_stat.ls_depth_max)
+        lcd_stat.ls_depth_max = depth;
+
+    sreg = SREG;
+    cli();
+    if (!(LCD_T0_TIMSK & _BV(LCD_T0_OCIE)))
+    {
+        TCNT0 = 0;
+        LCD_T0_OCR = 0;
+        LCD_T0_TIFR = _BV(LCD_T0_OCF);
+        LCD_T0_TIMSK |= _BV(LCD_T0_OCIE);
+    }
+    SREG = sreg;
+}
+
+/*************************************************************************
+Wait for the interrupt to empty the queue and give the last byte its time
+*************************************************************************/
+void lcd_wait(void)
+{
+    while (LCD_T0_TIMSK & _BV(LCD_T0_OCIE))
+        ;
+}
+
+/*************************************************************************
+One byte per interrupt. The compare value set here is the time until
+the next one. The interrupt turns itself off once the last byte has had
+its execution time.
+*************************************************************************/
+ISR(LCD_T0_VECT)
+{
+    uint8_t tail = lcd_q_tail;
+    uint8_t n, t;
+    uint16_t e;
+
+    lcd_q_counts += LCD_T0_OCR + 1;
+
+    if (tail == lcd_q_head)
+    {
+        LCD_T0_TIMSK &= ~_BV(LCD_T0_OCIE);
+
+        lcd_stat.ls_drain = lcd_q_counts < 0xffff / LCD_T0_US ? lcd_q_counts * LCD_T0_US : 0xffff;
+        if (lcd_stat.ls_drain > lcd_stat.ls_drain_max)
+            lcd_stat.ls_drain_max = lcd_stat.ls_drain;
+        lcd_q_counts = 0;
+        return;
+    }
+
+    e = lcd_q[tail];
+    if (e & LCD_Q_RS)
+        lcd_rs_high();
+    else
+        lcd_rs_low();
+#if !LCD_RW_HARDWIRED
+    lcd_rw_low();
+#endif
+
+#if LCD_BUS_8BIT
+    LCD_DATA_PORT = e;
+#else
+    /* the E cycle is only a microsecond, so both nibbles go now */
+    lcd_nibble(e >> 4);
+    lcd_e_toggle();
+    lcd_nibble(e);
+#endif
+    lcd_e_high();
+    lcd_e_delay();
+    lcd_e_low();
+
+    lcd_q_tail = (tail + 1) & (LCD_QUEUE - 1);
+    if (e & LCD_Q_RS)
+        n = LCD_T0_COUNTS(LCD_WRITE_US);
+    else if (e < 4)             /* clear and home */
+        n = LCD_T0_COUNTS(LCD_CLEAR_US);
+    else
+        n = LCD_T0_COUNTS(LCD_EXEC_US);
+
+    /*
+     * The next byte waits at least n whole counts from now. This interrupt
+     * can be held up by the tick, so TCNT0 may be well past the match:
+     * count on from it, as a compare value it has already passed would
+     * only match after it wrapped. If that won't fit start the timer again
+     * from 0.
+     */
+    t = TCNT0;
+    if (t > 0xFF - n)
+    {
+        lcd_q_counts += t;
+        TCNT0 = 0;
+        t = 0;
+    }
+    LCD_T0_OCR = t + n;
+}
+#endif
+
+
 /*************************************************************************
 Low-level function to read byte from LCD controller
 Input:    rs     1: read data    
                  0: read busy flag / address counter
 Returns:  byte read from LCD controller
 *************************************************************************/
-#if !LCD_RW_HARDWIRED
+#if !LCD_RW_HARDWIRED && !LCD_ASYNC
 #if LCD_IO_MODE
 static uint8_t lcd_read(uint8_t rs) 
 {
@@ -240,6 +460,14 @@ static uint8_t lcd_read(uint8_t rs)
         lcd_rs_low();                        /* RS=0: read busy flag */
     lcd_rw_high();                           /* RW=1  read mode      */
     
+#if LCD_BUS_8BIT
+    DDR(LCD_DATA_PORT) = 0x00;               /* configure data pins as input */
+
+    lcd_e_high();
+    lcd_e_delay();
+    data = PIN(LCD_DATA_PORT);
+    lcd_e_low();
+#else
     if ( ( &LCD_DATA0_PORT == &LCD_DATA1_PORT) && ( &LCD_DATA1_PORT == &LCD_DATA2_PORT ) && ( &LCD_DATA2_PORT == &LCD_DATA3_PORT )
       && ( LCD_DATA0_PIN == 0 )&& (LCD_DATA1_PIN == 1) && (LCD_DATA2_PIN == 2) && (LCD_DATA3_PIN == 3) )
     {
@@ -286,6 +514,7 @@ static uint8_t lcd_read(uint8_t rs)
         if ( PIN(LCD_DATA3_PORT) & _BV(LCD_DATA3_PIN) ) data |= 0x08;        
         lcd_e_low();
     }
+#endif
     return data;
 }
 #else
@@ -298,7 +527,7 @@ static uint8_t lcd_read(uint8_t rs)
 /*************************************************************************
 loops while lcd is busy, returns address counter
 *************************************************************************/
-#if !LCD_RW_HARDWIRED
+#if !LCD_RW_HARDWIRED && !LCD_ASYNC
 static uint8_t lcd_waitbusy(void)
 
 {
@@ -371,10 +600,14 @@ Returns: none
 *************************************************************************/
 void inline lcd_command(uint8_t cmd)
 {
+#if LCD_ASYNC
+    lcd_queue(cmd, 0);
+#else
 #if !LCD_RW_HARDWIRED
     lcd_waitbusy();
 #endif
     lcd_write(cmd,0);
+#endif
 }
 
 
@@ -385,10 +618,14 @@ Returns: none
 *************************************************************************/
 void inline lcd_data(uint8_t data)
 {
+#if LCD_ASYNC
+    lcd_queue(data, 1);
+#else
 #if !LCD_RW_HARDWIRED
     lcd_waitbusy();
 #endif
     lcd_write(data,1);
+#endif
 }
 
 
@@ -401,6 +638,10 @@ Returns:  none
 *************************************************************************/
 void lcd_gotoxy(uint8_t x, uint8_t y)
 {
+#if LCD_SHADOW
+    lcd_x = x;
+    lcd_y = y < LCD_LINES ? y : LCD_LINES - 1;
+#else
 #if LCD_LINES==1
     lcd_command((1<<LCD_DDRAM)+LCD_START_LINE1+x);
 #endif
@@ -420,13 +661,14 @@ void lcd_gotoxy(uint8_t x, uint8_t y)
     else /* y==3 */
         lcd_command((1<<LCD_DDRAM)+LCD_START_LINE4+x);
 #endif
+#endif
 
 }/* lcd_gotoxy */
 
 
 /*************************************************************************
 *************************************************************************/
-#if !LCD_RW_HARDWIRED
+#if !LCD_RW_HARDWIRED && !LCD_ASYNC
 int lcd_getxy(void)
 {
 	return lcd_waitbusy();
@@ -438,7 +680,24 @@ Clear display and set cursor to home position
 *************************************************************************/
 void inline lcd_clrscr(void)
 {
+#if LCD_SHADOW
+    uint8_t x, y;
+
+    for (y = 0; y < LCD_LINES; y++)
+        for (x = 0; x < LCD_DISP_LENGTH; x++)
+            if (lcd_shadow[y][x] != ' ')
+            {
+                lcd_shadow[y][x] = ' ';
+                lcd_dirty = 1;
+            }
+    lcd_x = 0;
+    lcd_y = 0;
+
+    for (x = 0; x < LCD_BLINKS; x++)
+        lcd_blinks[x].lb_len = 0;
+#else
     lcd_command(1<<LCD_CLR);
+#endif
 }
 
 
@@ -447,7 +706,12 @@ Set cursor to home position
 *************************************************************************/
 void inline lcd_home(void)
 {
+#if LCD_SHADOW
+    lcd_x = 0;
+    lcd_y = 0;
+#else
     lcd_command(1<<LCD_HOME);
+#endif
 }
 
 
@@ -456,6 +720,176 @@ Display character at current cursor position
 Input:    character to be displayed                                       
 Returns:  none
 *************************************************************************/
+#if LCD_SHADOW
+void lcd_putc(char c)
+{
+    if (c=='\n')
+    {
+        lcd_x = 0;
+        lcd_y = lcd_y + 1 < LCD_LINES ? lcd_y + 1 : 0;
+        return;
+    }
+#if LCD_WRAP_LINES==1
+    if (lcd_x >= LCD_DISP_LENGTH)
+        lcd_putc('\n');
+#endif
+    if (lcd_x < LCD_DISP_LENGTH)
+    {
+        if (lcd_shadow[lcd_y][lcd_x] != c)
+        {
+            lcd_shadow[lcd_y][lcd_x] = c;
+            lcd_dirty = 1;
+        }
+        lcd_x++;
+    }
+
+}/* lcd_putc */
+
+
+/*************************************************************************
+Find the blink slot for the run starting at x,y, or a free one
+*************************************************************************/
+static lcd_blink_t *lcd_blink_find(uint8_t x, uint8_t y)
+{
+    lcd_blink_t *b, *spare = NULL;
+
+    for (b = lcd_blinks; b < lcd_blinks + LCD_BLINKS; b++)
+    {
+        if (b->lb_len && b->lb_x == x && b->lb_y == y)
+            return b;
+        if (!b->lb_len && !spare)
+            spare = b;
+    }
+    return spare;
+
+}/* lcd_blink_find */
+
+
+/*************************************************************************
+Set a run of characters blinking
+Input:    x,y     first character
+          len     characters in the run
+          on_ms   time shown, msec
+          off_ms  time blanked, msec
+Returns:  0 if there is no free blink slot
+*************************************************************************/
+uint8_t lcd_blink(uint8_t x, uint8_t y, uint8_t len, uint16_t on_ms, uint16_t off_ms)
+{
+    lcd_blink_t *b = lcd_blink_find(x, y);
+
+    if (!b)
+        return 0;
+
+    if (b->lb_len && b->lb_hidden)
+        lcd_dirty = 1;
+    b->lb_x = x;
+    b->lb_y = y;
+    b->lb_len = len;
+    b->lb_on = on_ms < LCD_BLINK_MS ? 1 : on_ms / LCD_BLINK_MS;
+    b->lb_off = off_ms < LCD_BLINK_MS ? 1 : off_ms / LCD_BLINK_MS;
+    b->lb_ticks = 0;
+    b->lb_hidden = 0;
+
+    return 1;
+
+}/* lcd_blink */
+
+
+/*************************************************************************
+Stop the run starting at x,y blinking
+*************************************************************************/
+void lcd_blink_stop(uint8_t x, uint8_t y)
+{
+    lcd_blink_t *b = lcd_blink_find(x, y);
+
+    if (!b || !b->lb_len)
+        return;
+    if (b->lb_hidden)
+        lcd_dirty = 1;
+    b->lb_len = 0;
+
+}/* lcd_blink_stop */
+
+
+/*************************************************************************
+Count every blinking run on by one tick, switching phase when it is due
+*************************************************************************/
+void lcd_blink_tick(void)
+{
+    lcd_blink_t *b;
+
+    for (b = lcd_blinks; b < lcd_blinks + LCD_BLINKS; b++)
+    {
+        if (!b->lb_len)
+            continue;
+        if (++b->lb_ticks >= (b->lb_hidden ? b->lb_off : b->lb_on))
+        {
+            b->lb_ticks = 0;
+            b->lb_hidden = !b->lb_hidden;
+            lcd_dirty = 1;
+        }
+    }
+
+}/* lcd_blink_tick */
+
+
+/*************************************************************************
+What should be on the screen at x,y: lcd_shadow, or a space if a blinking
+run covering it is in its off phase
+*************************************************************************/
+static char lcd_cell(uint8_t x, uint8_t y)
+{
+    lcd_blink_t *b;
+
+    for (b = lcd_blinks; b < lcd_blinks + LCD_BLINKS; b++)
+        if (b->lb_len && b->lb_hidden && b->lb_y == y &&
+            x >= b->lb_x && x - b->lb_x < b->lb_len)
+            return ' ';
+    return lcd_shadow[y][x];
+
+}/* lcd_cell */
+
+
+/*************************************************************************
+Send what has changed in lcd_shadow, and in which blinking runs are
+blanked, since the last call. Unchanged cells between two changes are
+resent when that is cheaper than another DDRAM address set, see
+LCD_FLUSH_GAP.
+*************************************************************************/
+void lcd_flush(void)
+{
+    uint8_t x, y, last, i;
+    char c;
+
+    if (!lcd_dirty)
+        return;
+    lcd_dirty = 0;
+
+    for (y = 0; y < LCD_LINES; y++)
+    {
+        for (x = 0; x < LCD_DISP_LENGTH; x++)
+        {
+            if (lcd_cell(x, y) == lcd_shown[y][x])
+                continue;
+
+            /* find the end of this run, carrying on over short gaps */
+            last = x;
+            for (i = x + 1; i < LCD_DISP_LENGTH && i <= last + LCD_FLUSH_GAP + 1; i++)
+                if (lcd_cell(i, y) != lcd_shown[y][i])
+                    last = i;
+
+            lcd_command((1<<LCD_DDRAM)+lcd_line_start[y]+x);
+            for (; x <= last; x++)
+            {
+                c = lcd_cell(x, y);
+                lcd_data(c);
+                lcd_shown[y][x] = c;
+            }
+        }
+    }
+
+}/* lcd_flush */
+#else
 void lcd_putc(char c)
 {
     uint8_t pos;
@@ -501,6 +935,7 @@ void lcd_putc(char c)
     }
 
 }/* lcd_putc */
+#endif
 
 
 /*************************************************************************
@@ -547,7 +982,33 @@ Returns:  none
 *************************************************************************/
 void lcd_init(uint8_t dispAttr)
 {
-#if LCD_IO_MODE
+#if LCD_IO_MODE && LCD_BUS_8BIT
+    /*
+     *  Initialize LCD to 8 bit I/O mode
+     */
+    DDR(LCD_DATA_PORT) = 0xFF;
+    DDR(LCD_RS_PORT)   |= _BV(LCD_RS_PIN);
+#if !LCD_RW_HARDWIRED
+    DDR(LCD_RW_PORT)   |= _BV(LCD_RW_PIN);
+#endif
+    DDR(LCD_E_PORT)    |= _BV(LCD_E_PIN);
+
+    delay(16000);        /* wait 16ms or more after power-on       */
+
+    LCD_DATA_PORT = LCD_FUNCTION_8BIT_1LINE;
+    lcd_e_toggle();
+    delay(4992);         /* delay, busy flag can't be checked here */
+
+    /* repeat last command */
+    lcd_e_toggle();
+    delay(64);           /* delay, busy flag can't be checked here */
+
+    /* repeat last command a third time */
+    lcd_e_toggle();
+    delay(64);           /* delay, busy flag can't be checked here */
+
+    /* from now the LCD accepts 8 bit I/O, we can use lcd_command() */
+#elif LCD_IO_MODE
     /*
      *  Initialize LCD to 4 bit I/O mode
      */
@@ -624,6 +1085,16 @@ void lcd_init(uint8_t dispAttr)
     delay(64);                              /* wait 64us                    */
 #endif
 
+#if LCD_ASYNC
+    /* lcd_command() queues for TIMER0: CTC at clk/256, lcd_queue() enables the interrupt */
+#if defined(__AVR_ATmega128__)
+    TCCR0 = _BV(WGM01) | _BV(CS02) | _BV(CS01);
+#else
+    TCCR0A = _BV(WGM01);
+    TCCR0B = _BV(CS02);
+#endif
+#endif
+
 #if KS0073_4LINES_MODE
     /* Display with KS0073 controller requires special commands for enabling 4 line mode */
 	lcd_command(KS0073_EXTENDED_FUNCTION_REGISTER_ON);
@@ -633,7 +1104,14 @@ void lcd_init(uint8_t dispAttr)
     lcd_command(LCD_FUNCTION_DEFAULT);      /* function set: display lines  */
 #endif
     lcd_command(LCD_DISP_OFF);              /* display off                  */
-    lcd_clrscr();                           /* display clear                */ 
+    lcd_command(1<<LCD_CLR);                /* display clear                */
+#if LCD_SHADOW
+    memset(lcd_shadow, ' ', sizeof(lcd_shadow));
+    memset(lcd_shown, ' ', sizeof(lcd_shown));
+    memset(lcd_blinks, 0, sizeof(lcd_blinks));
+    lcd_x = lcd_y = 0;
+    lcd_dirty = 0;
+#endif
     lcd_command(LCD_MODE_DEFAULT);          /* set entry mode               */
     lcd_command(dispAttr);                  /* display/cursor control       */
 
@@ -19,7 +19,7 @@
  added 4-bit I/O mode, improved and optimized code.
        
  Library can be operated in memory mapped mode (LCD_IO_MODE=0) or in 
- 4-bit IO port mode (LCD_IO_MODE=1). 8-bit IO port mode not supported.
+ IO port mode (LCD_IO_MODE=1), 4-bit or, with LCD_BUS_8BIT, 8-bit.
 
  Memory mapped mode compatible with Kanda STK200, but supports also 
  generation of R/W signal through A8 address line.
@@ -38,7 +38,9 @@
 #endif
 
 #include <inttypes.h>
+#ifndef LCD_HOST
 #include <avr/pgmspace.h>
+#endif
 
 /** 
  *  @name  Definitions for MCU Clock Frequency
@@ -66,8 +68,62 @@
 #define LCD_START_LINE4  0x54     /**< DDRAM address of first char of line 4 */
 #define LCD_WRAP_LINES      0     /**< 0: no wrap, 1: wrap at end of visibile line */
 
+/**
+ * With LCD_SHADOW set lcd_gotoxy(), lcd_putc(), lcd_puts() and lcd_clrscr()
+ * only draw into a copy of the screen in RAM. lcd_flush() then sends the
+ * characters that differ from what is already on the display, so redrawing
+ * a field that hasn't changed costs nothing on the bus. Text past the end of
+ * a visible line is dropped. lcd_command() and lcd_data() still go straight
+ * to the controller. lcd_clrscr() doesn't send LCD_CLR, so it won't undo a
+ * display shift; send 1<<LCD_HOME for that.
+ */
+#ifndef LCD_SHADOW
+#define LCD_SHADOW          1     /**< 0: draw straight to the LCD, 1: draw to RAM and lcd_flush() */
+#endif
+
+/**
+ * With LCD_SHADOW runs of characters can be set blinking with lcd_blink().
+ * They are drawn as usual and lcd_flush() sends spaces in their place while
+ * they are in their off phase, so the caller never redraws them itself. All
+ * of them are timed by one call to lcd_blink_tick() every LCD_BLINK_MS.
+ * Without LCD_SHADOW lcd_blink() and lcd_blink_stop() do nothing and the
+ * runs are shown steadily.
+ */
+#define LCD_BLINKS          4     /**< runs that can blink at once */
+#define LCD_BLINK_MS      100     /**< lcd_blink_tick() period, msec */
+
+/**
+ * With LCD_ASYNC set lcd_command() and lcd_data() only queue the byte and
+ * return. The TIMER0 compare interrupt clocks the queue out a byte at a
+ * time, spacing the writes by the controller's execution times instead of
+ * spinning in delay() or on the busy flag. A caller only waits if the queue
+ * is full, so it must not be called with interrupts off. The busy flag is
+ * never read, which leaves nothing for lcd_putc() to find the cursor with,
+ * so this needs LCD_SHADOW.
+ */
+#ifndef LCD_ASYNC
+#define LCD_ASYNC           1     /**< 0: write in the caller, 1: queue for the TIMER0 interrupt */
+#endif
+#define LCD_QUEUE          64     /**< bytes queued for the controller, a power of 2 */
+
+#if LCD_ASYNC && !LCD_SHADOW
+#error "LCD_ASYNC needs LCD_SHADOW"
+#endif
+
 
 #define LCD_IO_MODE      1         /**< 0: memory mapped mode, 1: IO port mode */
+
+/**
+ * IO port mode normally uses four data lines, and every byte goes over in
+ * two halves. A board with a whole port free can set LCD_BUS_8BIT and
+ * define LCD_DATA_PORT, with D0-D7 on its pins 0-7. Each byte then takes a
+ * single store and one E pulse. LCD_DATA0_PORT to LCD_DATA3_PORT aren't
+ * used.
+ */
+#ifndef LCD_BUS_8BIT
+#define LCD_BUS_8BIT     0         /**< 0: 4-bit on LCD_DATA0..3, 1: 8-bit on all of LCD_DATA_PORT */
+#endif
+
 #if LCD_IO_MODE
 /**
  *  @name Definitions for 4-bit IO mode
@@ -84,7 +140,9 @@
  *  
  */
 #if defined(_DEV_BOARD_)
-#define LCD_RW_HARDWIRED 1
+#ifndef LCD_RW_HARDWIRED
+#define LCD_RW_HARDWIRED 1            /**< 1: R/W tied low, 0: on LCD_RW_PIN so the busy flag can be read */
+#endif
 #define LCD_PORT         PORTG        /**< port for the LCD lines   */
 #define LCD_DATA0_PORT   LCD_PORT     /**< port for 4bit data bit 0 */
 #define LCD_DATA1_PORT   LCD_PORT     /**< port for 4bit data bit 1 */
@@ -116,10 +174,16 @@
 #define LCD_RW_PIN       5            /**< pin  for RW line         */
 #define LCD_E_PORT       LCD_PORT     /**< port for Enable line     */
 #define LCD_E_PIN        4            /**< pin  for Enable line     */
+#elif defined(LCD_HOST)
+/* lcd_bench.cpp defines the lines for each bus it times */
 #else
 #error "Either _DEV_BOARD_ or _FSBUS_ must be defined (and check you select the right MCU"
 #endif
 
+#if LCD_BUS_8BIT && !defined(LCD_DATA_PORT)
+#error "LCD_BUS_8BIT needs LCD_DATA_PORT, a whole port for D0-D7"
+#endif
+
 #elif defined(__AVR_AT90S4414__) || defined(__AVR_AT90S8515__) || defined(__AVR_ATmega64__) || \
       defined(__AVR_ATmega8515__)|| defined(__AVR_ATmega103__) || defined(__AVR_ATmega128__) || \
       defined(__AVR_ATmega161__) || defined(__AVR_ATmega162__)
@@ -277,6 +341,81 @@ extern void inline lcd_command(uint8_t cmd);
 extern void lcd_data(uint8_t data);
 
 
+/**
+ @brief    Send the changes since the last flush to the display
+ Each run of changed characters on a line costs one DDRAM address set
+ followed by its data bytes. Does nothing if nothing has been drawn.
+ @param    void
+ @return   none
+*/
+#if LCD_SHADOW
+extern void lcd_flush(void);
+#else
+#define lcd_flush()
+#endif
+
+#if LCD_SHADOW
+/**
+ @brief    Blink a run of characters
+ Starts with the run shown. Blinking the same x,y again restarts it with the
+ new length and times. lcd_clrscr() stops everything blinking.
+ @param    x       horizontal position of the first character
+ @param    y       line of the run
+ @param    len     characters in the run
+ @param    on_ms   time shown, msec
+ @param    off_ms  time blanked, msec
+ @return   0 if LCD_BLINKS runs are already blinking
+*/
+extern uint8_t lcd_blink(uint8_t x, uint8_t y, uint8_t len, uint16_t on_ms, uint16_t off_ms);
+
+/**
+ @brief    Stop the run starting at x,y blinking, leaving it shown
+ @param    x       horizontal position of the first character
+ @param    y       line of the run
+ @return   none
+*/
+extern void lcd_blink_stop(uint8_t x, uint8_t y);
+
+/**
+ @brief    Move the blinking runs on, call every LCD_BLINK_MS msec
+ @param    void
+ @return   none
+*/
+extern void lcd_blink_tick(void);
+#else
+#define lcd_blink(...)          /* variadic, callers pass x,y as one macro */
+#define lcd_blink_stop(...)
+#endif
+
+/**
+ @brief    Number of commands and data bytes sent to the controller
+*/
+extern uint32_t lcd_writes;
+
+#if LCD_ASYNC
+/**
+ @brief    How the write queue is keeping up
+*/
+typedef struct lcd_stat_s {
+    uint8_t     ls_depth_max;   /**< most bytes ever waiting in the queue      */
+    uint16_t    ls_full;        /**< times a caller waited for room            */
+    uint16_t    ls_drain;       /**< last time from idle to empty, usec        */
+    uint16_t    ls_drain_max;   /**< longest time from idle to empty, usec     */
+} lcd_stat_t;
+
+extern volatile lcd_stat_t lcd_stat;
+
+/**
+ @brief    Wait until everything queued has gone to the controller
+ @param    void
+ @return   none
+*/
+extern void lcd_wait(void);
+#else
+#define lcd_wait()
+#endif
+
+
 /**
  @brief macros for automatically storing string constant in program memory
 */
@@ -0,0 +1,144 @@
+/*
+ * Count what lcd.c does on the bus for each character with the data lines
+ * 4-bit on pins 0-3 of one port (aligned), 4-bit on other pins (scattered)
+ * and 8-bit on a whole port. This is a host program, not part of the
+ * firmware. It is C++ so that the ports can count their reads and writes,
+ * and it builds lcd.c once for each bus and mode:
+ *
+ *	for bus in 0 1 2; do for async in 0 1; do
+ *		c++ -std=gnu++11 -O2 -DLCD_BENCH_BUS=$bus -DLCD_ASYNC=$async -o lcd_bench lcd_bench.cpp &&
+ *		./lcd_bench
+ *	done; done
+ *
+ * The lines are on PORTC as on the FSBUS board, with R/W hardwired. The
+ * scattered bus has D4-D7 on pins 3 down to 0, so each nibble goes a bit
+ * at a time. The 8-bit bus has D0-D7 on PORTA. A read or write of a port,
+ * its DDR or its PIN register counts as one each, so an sbi or cbi is one
+ * of both. Without LCD_ASYNC lcd_data() is counted, along with the cycles
+ * it spends in delay loops; with it the TIMER0 interrupt that sends each
+ * byte is, lcd_data() only queueing it.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#define F_CPU			16000000UL
+#define LCD_HOST
+#define LCD_RW_HARDWIRED	1
+
+#define PROGMEM
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define _BV(b)				(1 << (b))
+#define ISR(v)				void v(void)
+#define cli()				do { } while (0)
+#define sei()				do { } while (0)
+
+#ifndef LCD_BENCH_BUS
+#define LCD_BENCH_BUS		0
+#endif
+
+#define BENCH_CHARS			1000
+
+static uint32_t bench_reads, bench_writes, bench_pulses;
+static uint32_t bench_delay;		/* Cycles in delay loops */
+
+/*
+ * An IO register that counts its accesses, and E pulses if it has E on it
+ */
+struct io_reg {
+	uint8_t		v;
+
+	operator uint8_t() const;
+	io_reg &operator=(uint8_t x);
+	io_reg &operator|=(uint8_t x) { return *this = *this | x; }
+	io_reg &operator&=(uint8_t x) { return *this = *this & x; }
+};
+
+/* PIN, DDR and PORT in that order, as DDR() and PIN() in lcd.c expect */
+static io_reg bench_c[3];
+#define PORTC				bench_c[2]
+
+#define LCD_PORT			PORTC
+#define LCD_DATA0_PORT		LCD_PORT
+#define LCD_DATA1_PORT		LCD_PORT
+#define LCD_DATA2_PORT		LCD_PORT
+#define LCD_DATA3_PORT		LCD_PORT
+#if LCD_BENCH_BUS == 1
+#define LCD_DATA0_PIN		3
+#define LCD_DATA1_PIN		2
+#define LCD_DATA2_PIN		1
+#define LCD_DATA3_PIN		0
+#define BENCH_BUS			"4-bit scattered"
+#else
+#define LCD_DATA0_PIN		0
+#define LCD_DATA1_PIN		1
+#define LCD_DATA2_PIN		2
+#define LCD_DATA3_PIN		3
+#define BENCH_BUS			"4-bit aligned"
+#endif
+#if LCD_BENCH_BUS == 2
+static io_reg bench_a[3];
+#define PORTA				bench_a[2]
+#define LCD_BUS_8BIT		1
+#define LCD_DATA_PORT		PORTA
+#undef BENCH_BUS
+#define BENCH_BUS			"8-bit"
+#endif
+#define LCD_RS_PORT			LCD_PORT
+#define LCD_RS_PIN			6
+#define LCD_RW_PORT			LCD_PORT
+#define LCD_RW_PIN			5
+#define LCD_E_PORT			LCD_PORT
+#define LCD_E_PIN			4
+
+io_reg::operator uint8_t() const
+{
+	bench_reads++;
+	return v;
+}
+
+io_reg &io_reg::operator=(uint8_t x)
+{
+	if (this == &LCD_E_PORT && (x & ~v & _BV(LCD_E_PIN)))
+		bench_pulses++;
+	bench_writes++;
+	v = x;
+	return *this;
+}
+
+#if LCD_ASYNC
+/* Just the TIMER0 registers LCD_ASYNC uses, not counted */
+#define WGM01				1
+#define CS02				2
+#define OCIE0A				1
+#define OCF0A				1
+static uint8_t SREG, TCCR0A, TCCR0B, TCNT0, OCR0A, TIMSK0, TIFR0;
+#endif
+
+#define lcd_e_delay()		bench_delay += 2;
+
+static void _delayFourCycles(unsigned int count)
+{
+	bench_delay += count ? count * 4 : 2;
+}
+
+#include "lcd.c"
+
+int main(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_CHARS; i++) {
+#if LCD_ASYNC
+		lcd_data('A' + i % 26);
+		TIMER0_COMPA_vect();
+#else
+		lcd_data('A' + i % 26);
+#endif
+	}
+
+	printf("%-15s %-5s: %4.1f reads %4.1f writes %3.1f E pulses, %5.1f us in delay loops a character\n",
+		BENCH_BUS, LCD_ASYNC ? "async" : "sync",
+		(double)bench_reads / BENCH_CHARS, (double)bench_writes / BENCH_CHARS,
+		(double)bench_pulses / BENCH_CHARS, bench_delay * 1e6 / F_CPU / BENCH_CHARS);
+	return 0;
+}
@@ -11,16 +11,17 @@
 #include "lcd.h"
 #include "uart.h"
 
+#include "clock.h"
+#include "event.h"
+#include "console.h"
+
 #ifndef DEBUG
 #include "soft_uart.h"
 #endif
 
-#include "event.h"
-
 #include "kap.h"
 #include "switches.h"
 #include "fsbus.h"
-#include "clock.h"
 
 #ifndef F_CPU
 #error "F_CPU Must be defined!"
@@ -53,6 +54,7 @@ static void inline init_lcd()
 	lcd_puts_P("Initialised");
 	lcd_gotoxy(2,1);
 	lcd_puts_P("KAP-140");
+	lcd_flush();
 
 	delay_ms(500);
 
@@ -86,6 +88,8 @@ main(void)
 
 	clock_init();	
 
+	console_init();
+
 #ifdef DEBUG 
 	stdout = stdin = stderr = &term_str;	
 	printf("kap140 project\n\r");
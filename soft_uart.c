@@ -5,17 +5,46 @@
 // we need two serial lines, and there's only one usart on the M32
 // so we implement another in software
 //
-// we set up a clock with a timeout of 883 cycles - four times baud rate at 2400 baud - 
-// and use it to sample an input line and clock an output line
-// we also use it to maintain a 20mS tick for timouts and such
+// we use the TIMER1 compare A interrupt, four times per bit, to sample an input
+// line and clock an output line. TIMER1 itself free runs at clk/8 for the
+// clock (see clock.c), so the compare is moved on by a quarter bit each time
+// and the interrupt is only enabled while there is something to send.
+//
+// with SOFT_UART_OC1B the compare B hardware sets or clears the TX pin itself
+// on each bit edge, and the interrupt just sets up the level for the edge
+// after. the edges don't depend on interrupt latency at all.
+//
+// receive waits for the falling edge of a start bit on INT0, then turns on
+// the compare A interrupt and takes a majority vote of the last three of the
+// four samples in each bit. INT0 goes back on after the stop bit.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////
 #include <inttypes.h>
+#ifndef SOFT_UART_HOST
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#endif
 #include <stdio.h>
+#include "clock.h"
+#include "event.h"
 #include "soft_uart.h"
 
+// TIMER1 counts per quarter bit, rounded
+#define SOFT_UART_PERIOD	((F_CPU / 8 + SOFT_BAUD_RATE * 2) / (SOFT_BAUD_RATE * 4))
+
+#ifdef SOFT_UART_OC1B
+// TIMER1 counts per bit, rounded
+#define SOFT_UART_BIT		((F_CPU / 8 + SOFT_BAUD_RATE / 2) / SOFT_BAUD_RATE)
+// counts to the first edge, enough to get out of soft_uart_start()
+#define SOFT_UART_LEAD		8
+
+#define COM1B_SET			(_BV(COM1B1) | _BV(COM1B0))
+#define COM1B_CLEAR			_BV(COM1B1)
+#endif
+
+volatile isr_stat_t soft_uart_stat;
+volatile uint16_t soft_uart_rx_errors;	// framing errors and overruns
+
 // clock times
 static volatile uint8_t ticks;			// 192 of these make 1/50th of a second
 
@@ -35,8 +64,102 @@ static volatile unsigned char UART_TxTail;
 // status bits
 #define txbusy 0				// set if a byte is in transmission
 
-//ISR(SIG_OUTPUT_COMPARE1A)
-void soft_uart_isr(void)
+// receiver
+static volatile uint8_t	uart_rxd;		// the byte being received
+static volatile uint8_t	uart_rxtick;	// quarter bit within the bit
+static volatile uint8_t	uart_rxbit;		// 0 idle, 1 start bit, 2-9 data, 10 stop
+static volatile uint8_t	uart_rxvotes;	// high samples this bit
+
+#define UART_RX_BUFFER_SIZE  16
+#define UART_RX_BUFFER_MASK ( UART_RX_BUFFER_SIZE - 1)
+
+static volatile unsigned char UART_RxBuf[UART_RX_BUFFER_SIZE];
+static volatile unsigned char UART_RxHead;
+static volatile unsigned char UART_RxTail;
+
+static event_handle uart_rx_notify;		// posted for each byte received
+
+/*
+ * Listen for a start bit
+ */
+static inline void soft_uart_rx_arm(void)
+{
+	EIFR = _BV(INTF0);			// forget edges from the last byte
+	EIMSK |= _BV(INT0);
+}
+
+/*
+ * Called four times a bit from the compare A interrupt. Returns non zero
+ * while a byte is coming in.
+ */
+static uint8_t soft_uart_rx(void)
+{
+	unsigned char tmphead;
+	uint8_t bit;
+
+	if (!uart_rxbit)
+		return 0;
+
+	uart_rxtick++;
+
+	if (uart_rxbit == 10) {
+		// the stop bit, decided early so we're listening again well before
+		// the next start bit
+		if (uart_rxtick < 2)
+			return 1;
+
+		if (PIND & _BV(uartrx)) {
+			tmphead = (UART_RxHead + 1) & UART_RX_BUFFER_MASK;
+			if (tmphead != UART_RxTail) {
+				UART_RxBuf[tmphead] = uart_rxd;
+				UART_RxHead = tmphead;
+				if (uart_rx_notify)
+					event_post(uart_rx_notify);
+			} else {
+				soft_uart_rx_errors++;		// overrun
+			}
+		} else {
+			soft_uart_rx_errors++;			// framing
+		}
+
+		uart_rxbit = 0;
+		soft_uart_rx_arm();
+		return 0;
+	}
+
+	if (uart_rxtick >= 2 && (PIND & _BV(uartrx)))
+		uart_rxvotes++;
+
+	if (uart_rxtick < 4)
+		return 1;
+
+	bit = uart_rxvotes >= 2;
+	uart_rxtick = 0;
+	uart_rxvotes = 0;
+
+	if (uart_rxbit == 1) {
+		if (bit) {
+			// just a glitch, not a start bit
+			uart_rxbit = 0;
+			soft_uart_rx_arm();
+			return 0;
+		}
+	} else {
+		uart_rxd >>= 1;
+		if (bit)
+			uart_rxd |= 0x80;
+	}
+	uart_rxbit++;
+
+	return 1;
+}
+
+#ifndef SOFT_UART_OC1B
+/*
+ * Returns non zero while there is still something being sent, so the
+ * interrupt knows when it can turn itself off.
+ */
+static uint8_t soft_uart_isr(void)
 {
 	unsigned char tmptail;
 
@@ -104,8 +227,168 @@ void soft_uart_isr(void)
 	
 	// increment the clock
 	ticks++;
+
+	return (uart_status & _BV(txbusy)) || UART_TxHead != UART_TxTail;
+}
+
+#endif
+
+//ISR(SIG_OUTPUT_COMPARE1A)
+ISR(TIMER1_COMPA_vect)
+{
+	uint16_t start = TCNT1;
+	uint8_t busy;
+
+	OCR1A += SOFT_UART_PERIOD;
+
+	busy = soft_uart_rx();
+#ifndef SOFT_UART_OC1B
+	busy |= soft_uart_isr();
+#endif
+	if (!busy)
+		CLOCK_T1_TIMSK &= ~_BV(OCIE1A);	// all done, stop interrupting
+
+	clock_isr_account(&soft_uart_stat, start);
+}
+
+/*
+ * Start the compare A interrupt, if it isn't running. The first is an eighth
+ * of a bit from now, so all four samples of a bit fall inside it.
+ */
+static void soft_uart_tick_start(void)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if (!(CLOCK_T1_TIMSK & _BV(OCIE1A))) {
+		OCR1A = TCNT1 + SOFT_UART_PERIOD / 2;
+		CLOCK_T1_TIFR = _BV(OCF1A);		// clear any stale match
+		CLOCK_T1_TIMSK |= _BV(OCIE1A);
+	}
+	SREG = sreg;
+}
+
+/*
+ * The falling edge of a start bit
+ */
+ISR(INT0_vect)
+{
+	EIMSK &= ~_BV(INT0);		// the compare interrupt takes it from here
+	uart_rxbit = 1;
+	uart_rxtick = 0;
+	uart_rxvotes = 0;
+	soft_uart_tick_start();
+}
+
+#ifndef SOFT_UART_OC1B
+/*
+ * Start clocking out whatever has been queued
+ */
+static void soft_uart_start(void)
+{
+	soft_uart_tick_start();
+}
+
+#else /* SOFT_UART_OC1B */
+
+/*
+ * The level for the next bit edge, or -1 if there's nothing more to send.
+ * uart_txbit counts 0 for the start bit to 9 for the stop bit. 10 is after
+ * a stop bit and 11 is idle. The line is held high for one more bit after
+ * the last stop bit before the interrupt stops, so a byte sent straight
+ * after still gets a whole stop bit.
+ */
+static int8_t soft_uart_next(void)
+{
+	unsigned char tmptail;
+	uint8_t bit;
+
+	if (uart_txbit >= 10) {
+		if (UART_TxHead == UART_TxTail) {
+			if (uart_txbit == 10) {
+				uart_txbit = 11;
+				return 1;
+			}
+			return -1;
+		}
+		/* get one byte from buffer and start it */
+		tmptail = (UART_TxTail + 1) & UART_TX_BUFFER_MASK;
+		UART_TxTail = tmptail;
+		uart_txd = UART_TxBuf[tmptail];
+		uart_txbit = 0;
+	}
+
+	if (uart_txbit == 0) {
+		uart_txbit++;
+		return 0;				// start bit
+	}
+	if (uart_txbit == 9) {
+		uart_txbit++;
+		return 1;				// stop bit
+	}
+
+	bit = uart_txd & 1;
+	uart_txd >>= 1;
+	uart_txbit++;
+	return bit;
 }
 
+/*
+ * Have the next compare match set or clear the pin
+ */
+static inline void soft_uart_level(int8_t level)
+{
+	TCCR1A = (TCCR1A & ~COM1B_SET) | (level ? COM1B_SET : COM1B_CLEAR);
+}
+
+/*
+ * We arrive here at each bit edge, once the hardware has already set the
+ * pin, with a whole bit time to set up the next one
+ */
+ISR(TIMER1_COMPB_vect)
+{
+	uint16_t start = TCNT1;
+	int8_t level;
+
+	OCR1B += SOFT_UART_BIT;
+
+	level = soft_uart_next();
+	if (level < 0)
+		CLOCK_T1_TIMSK &= ~_BV(OCIE1B);	// all sent, the line stays high
+	else
+		soft_uart_level(level);
+
+	clock_isr_account(&soft_uart_stat, start);
+}
+
+/*
+ * Start sending, with the start bit edge just after now, if not already
+ */
+static void soft_uart_start(void)
+{
+	uint8_t sreg;
+	int8_t level;
+
+	sreg = SREG;
+	cli();
+	if (!(CLOCK_T1_TIMSK & _BV(OCIE1B))) {
+		level = soft_uart_next();
+		if (level >= 0) {
+			// take the pin over from the port at the idle level
+			TCCR1A |= COM1B_SET;
+			TCCR1C = _BV(FOC1B);
+
+			OCR1B = TCNT1 + SOFT_UART_LEAD;
+			soft_uart_level(level);
+			CLOCK_T1_TIFR = _BV(OCF1B);		// clear any stale match
+			CLOCK_T1_TIMSK |= _BV(OCIE1B);
+		}
+	}
+	SREG = sreg;
+}
+#endif
+
 void soft_uart_init (void)
 {
 	// we wake up the timer, preset the clock and uart variables, and enable the ocr1a interrupt
@@ -125,13 +408,51 @@ void soft_uart_init (void)
 #endif
 */								// allow interrupts on output mask a
 	uart_status = 0;			// nothing happening either tx or rx
+#ifdef SOFT_UART_OC1B
+	uart_txbit = 11;			// idle
+#endif
 
     UART_TxHead = 0;
     UART_TxTail = 0;
 	
+    UART_RxHead = 0;
+    UART_RxTail = 0;
+	uart_rxbit = 0;
+
 	DDRD |= _BV(uarttx);		// and set the input and output pins
-	PORTD = _BV(uarttx);		// we're not using port d for anything else and
+	DDRD &= ~_BV(uartrx);
+	PORTD = _BV(uarttx) | _BV(uartrx);	// we're not using port d for anything else and
 								// the usart overrides the pin directions anyway
+								// rx has the pull up, so it idles high
+
+	EICRA = (EICRA & ~(_BV(ISC01) | _BV(ISC00))) | _BV(ISC01);	// INT0 on the falling edge
+	soft_uart_rx_arm();
+}
+
+/*
+ * Have the event h posted whenever a byte comes in
+ */
+void soft_uart_notify(event_handle h)
+{
+	uart_rx_notify = h;
+}
+
+/*
+ * Return the next byte received, or SOFT_UART_NO_DATA in the high byte if
+ * there isn't one
+ */
+unsigned int soft_uart_getc(void)
+{
+    unsigned char tmptail;
+
+    if ( UART_RxHead == UART_RxTail ) {
+        return SOFT_UART_NO_DATA;
+    }
+
+    tmptail = (UART_RxTail + 1) & UART_RX_BUFFER_MASK;
+    UART_RxTail = tmptail;
+
+    return UART_RxBuf[tmptail];
 }
 
 
@@ -148,6 +469,30 @@ void soft_uart_putc (char ch)
     
     UART_TxBuf[tmphead] = ch;
     UART_TxHead = tmphead;
+
+    soft_uart_start();		// make sure TIMER1 is clocking us out
+}
+
+/*
+ * Queue len bytes to send if they all fit, without waiting. Returns 0, with
+ * nothing queued, if there isn't room for them.
+ */
+uint8_t soft_uart_write(const char *s, uint8_t len)
+{
+	uint8_t head = UART_TxHead;
+
+	if (((uint8_t)(UART_TxTail - head - 1) & UART_TX_BUFFER_MASK) < len)
+		return 0;
+
+	while (len--) {
+		head = (head + 1) & UART_TX_BUFFER_MASK;
+		UART_TxBuf[head] = *s++;
+	}
+	UART_TxHead = head;
+
+	soft_uart_start();
+
+	return 1;
 }
 
 void soft_uart_print (char * t)
@@ -160,7 +505,7 @@ void soft_uart_print (char * t)
 }
 
 
-int soft_uart_putchar(char c, FILE *stream)
+int soft_uart_putchar(char c, __attribute__((unused)) FILE *stream)
 {
 	soft_uart_putc(c);
 	return 0;
@@ -4,12 +4,31 @@
 
 #define SOFT_BAUD_RATE 4800
 
+/*
+ * Define SOFT_UART_OC1B to have the TIMER1 compare B hardware drive TX on
+ * the OC1B pin, taking one interrupt per bit while a byte is going out.
+ * Otherwise TX is bit banged on PD3 from the compare A interrupt at four
+ * times the baud rate.
+ */
+//#define SOFT_UART_OC1B
+
 #define uartrx PD2				// will be PD2,3 to talk to the laptop
+#ifdef SOFT_UART_OC1B
+#define	uarttx PD4				// OC1B
+#else
 #define	uarttx PD3
+#endif
 
 
+#define SOFT_UART_NO_DATA	0x0100	// no receive data available
+
 void soft_uart_init(void);
 int soft_uart_putchar(char c, FILE *stream);
-void soft_uart_isr(void);
+uint8_t soft_uart_write(const char *s, uint8_t len);
+unsigned int soft_uart_getc(void);
+void soft_uart_notify(event_handle h);
+
+extern volatile isr_stat_t soft_uart_stat;	// The TIMER1 compare interrupts
+extern volatile uint16_t soft_uart_rx_errors;
 
 #endif
@@ -0,0 +1,302 @@
+/*
+ * Run the soft UART transmitter in soft_uart.c against a model of TIMER1
+ * and count its interrupts and the jitter of its bit edges. This is a host
+ * program, not part of the firmware. Build it once for each TX mode:
+ *
+ *	cc -std=gnu99 -O2 -o soft_uart_model soft_uart_model.c
+ *	cc -std=gnu99 -O2 -DSOFT_UART_OC1B -o soft_uart_model_oc1b soft_uart_model.c
+ *	soft_uart_model [tick cycles]
+ *
+ * TIMER1 counts at clk/8 as clock.c sets it up. A compare A or B match
+ * interrupts once interrupts are on, a random 4 to 7 cycles later. With
+ * COM1B set, a compare B match also sets or clears the OC1B pin right away.
+ * The 200Hz tick interrupt comes first when both are due, and it holds the
+ * others off for [tick cycles] (400 by default). Its real cost is
+ * clock_tick_stat in the console "stats". A handler takes ISR_CYCLES, and
+ * the compare A handler writes PORTD ISR_WRITE cycles into that.
+ *
+ * The TX line is kept busy for a second, then once the buffer has gone it is
+ * left idle for a second.
+ * The edges are decoded back into bytes, which must be what was sent. The
+ * jitter of an edge is how far it is from a whole number of bit times after
+ * the edge before.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define F_CPU			16000000UL
+#define SOFT_UART_HOST
+#define EVENT_HOST
+
+#define _BV(b)			(1 << (b))
+#define ISR(v)			void v(void)
+#define cli()			do { } while (0)
+#define sei()			do { } while (0)
+
+/* Just the registers soft_uart.c uses */
+#define PD2				2
+#define PD3				3
+#define PD4				4
+#define INT0			0
+#define INTF0			0
+#define ISC00			0
+#define ISC01			1
+#define OCIE1A			1
+#define OCIE1B			2
+#define OCF1A			1
+#define OCF1B			2
+#define COM1B0			4
+#define COM1B1			5
+#define FOC1B			6
+
+static uint8_t SREG, PORTD, PIND = 0xff, DDRD, EIFR, EIMSK, EICRA;
+static uint8_t TCCR1A, TIMSK1, TIFR1;
+static uint16_t OCR1A, OCR1B;
+
+static uint32_t model_cycles;		/* Simulated time */
+#define TCNT1			((uint16_t)(model_cycles / 8))
+
+#ifdef SOFT_UART_OC1B
+/*
+ * soft_uart.c only writes TCCR1C to force a compare B, so any write does
+ * it, with the COM1B bits as they are at the time
+ */
+static uint8_t *model_foc1b(void);
+#define TCCR1C			(*model_foc1b())
+#endif
+
+#include "event.h"
+
+void event_post(__attribute__((unused)) event_handle h)
+{
+}
+
+#include "clock.h"
+
+void clock_isr_account(volatile isr_stat_t *s, __attribute__((unused)) uint16_t start)
+{
+	s->is_count++;
+}
+
+#include "soft_uart.c"
+
+#define ISR_CYCLES		80			// Cost of a soft UART interrupt
+#define ISR_WRITE		30			// When the compare A one sets the pin
+#define TICK_CYCLES		(F_CPU / CLOCK)
+
+#ifdef SOFT_UART_OC1B
+#define MODEL_BIT		(SOFT_UART_BIT * 8)
+#define MODEL_MODE		"OC1B"
+#else
+#define MODEL_BIT		(SOFT_UART_PERIOD * 4 * 8)
+#define MODEL_MODE		"compare A"
+#endif
+
+#define MODEL_EDGES		(F_CPU / MODEL_BIT + 16)
+#define MODEL_SENT		(F_CPU / MODEL_BIT / 10 + 64)
+
+static uint32_t model_edge[MODEL_EDGES];	/* Time of each edge, the first is a fall */
+static uint32_t model_edges;
+static uint8_t model_line = 1;				/* The TX pin */
+static uint8_t model_oc1b = 1;				/* The OC1B output */
+static uint32_t model_blocked;				/* Interrupts are off until this time */
+static uint32_t model_tick;					/* Cycles the tick interrupt takes */
+static uint8_t model_pend_tick, model_pend_a, model_pend_b;
+static uint32_t model_irqs;
+
+static uint8_t model_sent[MODEL_SENT];
+static uint32_t model_nsent;
+
+/*
+ * The level on the TX pin, from PORTD or OC1B
+ */
+static uint8_t model_pin(void)
+{
+#ifdef SOFT_UART_OC1B
+	if (TCCR1A & (_BV(COM1B1) | _BV(COM1B0)))
+		return model_oc1b;
+#endif
+	return (PORTD & _BV(uarttx)) != 0;
+}
+
+static void model_watch(uint32_t t)
+{
+	uint8_t level = model_pin();
+
+	if (level != model_line) {
+		model_line = level;
+		if (model_edges < MODEL_EDGES)
+			model_edge[model_edges++] = t;
+	}
+}
+
+/*
+ * The compare B output action, on a match or a forced compare
+ */
+static void model_com1b(void)
+{
+	if (TCCR1A & _BV(COM1B1))
+		model_oc1b = (TCCR1A & _BV(COM1B0)) != 0;
+}
+
+#ifdef SOFT_UART_OC1B
+static uint8_t *model_foc1b(void)
+{
+	static uint8_t tccr1c;
+
+	model_com1b();
+	model_watch(model_cycles);
+	return &tccr1c;
+}
+#endif
+
+/*
+ * Run an interrupt handler at time t
+ */
+static void model_isr(void (*isr)(void), uint32_t t)
+{
+	t += 4 + rand() % 4;
+	model_cycles = t;
+	isr();
+	model_irqs++;
+	model_blocked = t + ISR_CYCLES;
+#ifdef SOFT_UART_OC1B
+	model_watch(t);
+#else
+	model_watch(t + ISR_WRITE);
+#endif
+}
+
+/*
+ * Let the hardware run for a number of cycles, optionally keeping the TX
+ * buffer full
+ */
+static void model_run(uint32_t cycles, uint8_t send)
+{
+	uint32_t end = model_cycles + cycles;
+	uint32_t t;
+	uint16_t count;
+	char c;
+
+	for (t = model_cycles; t != end; t += 8) {
+		model_cycles = t;
+		count = TCNT1;
+
+		if ((TIMSK1 & _BV(OCIE1A)) && count == OCR1A)
+			model_pend_a = 1;
+		if (count == OCR1B) {
+			model_com1b();
+			model_watch(t);
+			if (TIMSK1 & _BV(OCIE1B))
+				model_pend_b = 1;
+		}
+
+		if (t % TICK_CYCLES < 8)
+			model_pend_tick = 1;
+
+		if ((int32_t)(t - model_blocked) >= 0) {
+			if (model_pend_tick) {
+				model_pend_tick = 0;
+				model_blocked = t + model_tick;
+			} else if (model_pend_a) {
+				model_pend_a = 0;
+				model_isr(TIMER1_COMPA_vect, t);
+#ifdef SOFT_UART_OC1B
+			} else if (model_pend_b) {
+				model_pend_b = 0;
+				model_isr(TIMER1_COMPB_vect, t);
+#endif
+			}
+		}
+
+		/* The main loop, topping the buffer up between interrupts */
+		if (send && model_nsent < MODEL_SENT) {
+			model_cycles = t;
+			c = 'A' + model_nsent % 26;
+			if (soft_uart_write(&c, 1))
+				model_sent[model_nsent++] = c;
+		}
+	}
+	model_cycles = end;
+}
+
+/*
+ * The level of the line at time t
+ */
+static uint8_t model_level(uint32_t t)
+{
+	uint32_t i;
+	uint8_t level = 1;
+
+	for (i = 0; i < model_edges && (int32_t)(model_edge[i] - t) <= 0; i++)
+		level = !level;
+	return level;
+}
+
+/*
+ * Decode the edges as a UART would, sampling each bit in the middle.
+ * Returns the number of bytes that don't match what was sent.
+ */
+static uint32_t model_decode(uint32_t *bytes)
+{
+	uint32_t i, start, bad = 0;
+	uint8_t bit, c;
+
+	*bytes = 0;
+	for (i = 0; i < model_edges; i++) {
+		if (model_level(model_edge[i]) != 0)
+			continue;			// a rise
+		start = model_edge[i];
+		c = 0;
+		for (bit = 1; bit <= 8; bit++)
+			c |= model_level(start + bit * MODEL_BIT + MODEL_BIT / 2) << (bit - 1);
+		if (!model_level(start + 9 * MODEL_BIT + MODEL_BIT / 2) ||
+				*bytes >= model_nsent || c != model_sent[*bytes])
+			bad++;
+		(*bytes)++;
+
+		/* Past the stop bit to the next start */
+		while (i + 1 < model_edges && model_edge[i + 1] < start + 9 * MODEL_BIT + MODEL_BIT / 2)
+			i++;
+	}
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t i, d, dev, max = 0, total = 0, n = 0, bytes, bad, irqs;
+
+	model_tick = argc > 1 ? atol(argv[1]) : 400;
+	srand(1);
+
+	soft_uart_init();
+	model_cycles = 0;
+
+	model_run(F_CPU, 1);
+	irqs = model_irqs;
+	while (TIMSK1 & (_BV(OCIE1A) | _BV(OCIE1B)))
+		model_run(TICK_CYCLES, 0);		// the rest of the buffer
+	model_irqs = 0;
+	model_run(F_CPU, 0);
+
+	for (i = 1; i < model_edges; i++) {
+		d = model_edge[i] - model_edge[i - 1];
+		if (d > 10 * MODEL_BIT)
+			continue;			// idle in between, no bit grid to be on
+		dev = d % MODEL_BIT;
+		if (dev > MODEL_BIT / 2)
+			dev = MODEL_BIT - dev;
+		if (dev > max)
+			max = dev;
+		total += dev;
+		n++;
+	}
+
+	bad = model_decode(&bytes);
+	printf("%s, tick holds interrupts off for %u cycles\n", MODEL_MODE, model_tick);
+	printf("sending: %u bytes, %u interrupts/s; idle: %u interrupts/s\n", model_nsent, irqs, model_irqs);
+	printf("edges %u, jitter max %u mean %.1f cycles\n", n + 1, max, n ? (double)total / n : 0.0);
+	printf("decoded %u bytes, %u wrong\n", bytes, bad);
+	return bad != 0 || bytes != model_nsent;
+}
@@ -1,11 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
+#ifndef SWITCHES_HOST
 #include <avr/io.h>
+#endif
 #include <stdint.h>
+#ifndef SWITCHES_HOST
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
+#endif
 
 #include "event.h"
+#ifndef SWITCHES_HOST
+#include "trace.h"
+#endif
+#include "fr.h"
 
 
 /*
@@ -27,10 +35,15 @@ volatile int8_t sw_enc_delta;
  */
 volatile uint8_t sw_porta_state = 0, sw_portb_state = 0;
 
-void inline switches_init(void)
+/*
+ * The event to post whenever a debounced key or the encoder changes
+ */
+static event_handle sw_notify = 0;
+
+inline void switches_init(void)
 {
 
-	printf("switches_init()\n\r");
+	trace_info(INIT, "switches_init()\n\r");
 
 	/* Setup the ports */
 	DDRA = 0x00;	// All pins are INPUT
@@ -38,7 +51,17 @@ void inline switches_init(void)
 	DDRB = 0;		// All pins are INPUT
 	PORTB = 0xFF;	// Enable pull ups
 
-	printf("switches_init() - exit\n\r");
+	trace_debug(INIT, "switches_init() - exit\n\r");
+}
+
+
+/*
+ * Have the event h run as soon as a key is pressed or released or the
+ * encoder moves, instead of waiting for a poll
+ */
+void switches_notify(event_handle h)
+{
+	sw_notify = h;
 }
 
 
@@ -82,6 +105,7 @@ void switches_tick()
 	
 	static uint8_t porta_ct0 = 0, portb_ct0 = 0, porta_ct1 = 0, portb_ct1 = 0;
 	uint8_t porta_now, portb_now;
+	int8_t enc_delta = sw_enc_delta;
 
 	/*
 	 * read current state of keys (active-low),
@@ -137,6 +161,13 @@ void switches_tick()
 	sw_portb |= sw_portb_state & portb_now;
 
 	switches_encoder();
+
+	/* Hand any change straight to the main loop */
+	if (porta_now | portb_now || sw_enc_delta != enc_delta) {
+		fr_log(FR_SWITCH, sw_enc_delta, sw_porta_state << 8 | sw_portb_state);
+		if (sw_notify)
+			event_post(sw_notify);
+	}
 }
 
 
@@ -3,6 +3,7 @@
 
 void switches_init(void);
 void switches_tick(void);
+void switches_notify(event_handle h);
 
 extern volatile uint8_t sw_porta;
 extern volatile uint8_t sw_portb;
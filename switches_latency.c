@@ -0,0 +1,264 @@
+/*
+ * Measure the time from a key going down to the first byte of the FSBUS
+ * frame it causes, over switches_tick(), event_post(), event_run() and
+ * fsbus_snd(). This is a host program, not part of the firmware, it builds
+ * switches.c, event.c and fsbus_snd.c with the AVR parts stubbed out:
+ *
+ *	cc -std=gnu99 -O2 -o switches_latency switches_latency.c
+ *	switches_latency [presses [load cycles]]
+ *
+ * A simulated 16MHz CPU takes the 200Hz tick, switches_tick() then
+ * event_tick() as clock_isr() does, and runs event_run() in between as
+ * fsbus_main() does. The UP key on PA2 goes down at random, bounces a few
+ * times over up to 1.6ms, is held for 50 to 150ms and bounces
+ * again on the way up. It is then left up for 50 to 250ms. A normal
+ * priority callback burns [load cycles] (20000 by default) every tick.
+ * The key handler stands in for kap_buttons(): it takes BUTTON_CYCLES and
+ * sends DIO_SW_VS_UP as kap_button_up() does, and the time is taken when
+ * uart_putc() gets the first byte.
+ *
+ * It runs once with the handler posted at high priority through
+ * switches_notify(), as now, and once polled every 100ms at normal priority
+ * as it used to be. The press to frame time is split at the tick whose
+ * switches_tick() sees the debounced press.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define F_CPU		16000000UL
+#define RAMEND		0x10FF
+#define EVENT_HOST
+#define FSBUS_HOST
+#define SWITCHES_HOST
+#define FR_HOST
+
+#define _BV(b)					(1 << (b))
+#define PSTR(s)					(s)
+#define printf_P				printf
+#define snprintf_P				snprintf
+#define cli()					do { } while (0)
+#define sei()					do { } while (0)
+#define fr_log(id, arg, data)	do { } while (0)
+#define trace_info(mod, fmt, ...)	do { } while (0)
+#define trace_debug(mod, fmt, ...)	do { } while (0)
+
+/* Just the port registers switches.c uses, the encoder on PB0-1 stays put */
+#define PINB0		0
+#define PINB1		1
+#define PINA		sim_pina()
+#define PINB		0xFF
+uint8_t DDRA, PORTA, DDRB, PORTB;		// Not static, switches_init() is inline
+
+#define SIM_KEY		2				// The UP key, PA2
+
+static uint8_t sim_line = 1;		/* The key's pin, pulled up when open */
+
+static uint8_t sim_pina(void)
+{
+	return sim_line ? 0xFF : 0xFF & ~_BV(SIM_KEY);
+}
+
+#include "event.c"
+#include "switches.c"
+#include "fsbus_snd.c"
+
+#define SIM_US(us)		((uint32_t)(us) * (F_CPU / 1000000))
+#define SIM_TICK_CYCLES	(F_CPU / CLOCK)
+#define BUTTON_CYCLES	2000		// kap_buttons() and kap_button_up() up to the send
+#define SIM_CID			14			// KAP_DIO_CID
+#define SIM_VS_UP		10			// DIO_SW_VS_UP
+
+static uint32_t sim_cycles;			/* Simulated time */
+static uint32_t sim_tick_at;		/* sim_cycles of the next tick */
+static uint32_t sim_key_at;			/* and of the next edge on the key */
+static uint32_t sim_ticks;
+static uint32_t sim_load;
+
+static uint8_t sim_pressed;			/* Down, once it has stopped bouncing */
+static uint8_t sim_bounces;			/* Edges to go before it stops */
+static uint8_t sim_waiting;			/* Pressed, no frame yet */
+static uint32_t sim_press_at, sim_debounced_at;
+static uint32_t sim_presses, sim_frames;
+
+typedef struct sim_lat_s {
+	uint32_t	sl_min;
+	uint32_t	sl_max;
+	uint64_t	sl_total;			/* For the mean, sl_total / sim_frames */
+} sim_lat_t;
+
+static sim_lat_t sim_debounce, sim_frame, sim_total;
+
+uint32_t clock_cycles(void)
+{
+	return sim_cycles;
+}
+
+static void sim_lat_add(sim_lat_t *l, uint32_t c)
+{
+	if (c < l->sl_min)
+		l->sl_min = c;
+	if (c > l->sl_max)
+		l->sl_max = c;
+	l->sl_total += c;
+}
+
+/*
+ * The first byte of a frame is the end of the press it answers
+ */
+void uart_putc(unsigned char data)
+{
+	if (!sim_waiting || !(data & FS_DF_START))
+		return;
+	sim_waiting = 0;
+	sim_frames++;
+	sim_lat_add(&sim_debounce, sim_debounced_at - sim_press_at);
+	sim_lat_add(&sim_frame, sim_cycles - sim_debounced_at);
+	sim_lat_add(&sim_total, sim_cycles - sim_press_at);
+}
+
+/*
+ * The next edge on the key. Each bounce takes 100 to 400us, and the line
+ * ends up where the key is once they are done.
+ */
+static void sim_key(void)
+{
+	if (!sim_bounces) {
+		sim_pressed = !sim_pressed;
+		if (sim_pressed) {
+			sim_presses++;
+			sim_press_at = sim_cycles;
+			sim_waiting = 1;
+		}
+		sim_bounces = 2 * (rand() % 3);
+	} else
+		sim_bounces--;
+	sim_line = sim_pressed ? sim_bounces & 1 : !(sim_bounces & 1);
+
+	if (sim_bounces)
+		sim_key_at += SIM_US(100 + rand() % 300);
+	else if (sim_pressed)
+		sim_key_at += SIM_US(1000 * (50 + rand() % 100));
+	else
+		sim_key_at += SIM_US(1000 * (50 + rand() % 200));
+}
+
+/*
+ * clock_isr(), less the idle accounting
+ */
+static void sim_tick(void)
+{
+	uint8_t was = sw_porta & _BV(SIM_KEY);
+
+	switches_tick();
+	if (!was && (sw_porta & _BV(SIM_KEY)))
+		sim_debounced_at = sim_cycles;
+	event_tick(++sim_ticks);
+}
+
+/*
+ * Let n cycles go by, with the key moving and the tick interrupt coming in
+ */
+static void sim_burn(uint32_t n)
+{
+	uint32_t next;
+
+	while (n) {
+		next = sim_tick_at - sim_cycles;
+		if (sim_key_at - sim_cycles < next)
+			next = sim_key_at - sim_cycles;
+		if (n < next) {
+			sim_cycles += n;
+			return;
+		}
+		sim_cycles += next;
+		n -= next;
+
+		if (sim_cycles == sim_key_at)
+			sim_key();
+		if (sim_cycles == sim_tick_at) {
+			sim_tick_at += SIM_TICK_CYCLES;
+			sim_tick();
+		}
+	}
+}
+
+static void sim_load_run(__attribute__((unused)) uint32_t t)
+{
+	sim_burn(sim_load);
+}
+
+/*
+ * kap_buttons(), for the one key
+ */
+static void sim_buttons(__attribute__((unused)) uint32_t t)
+{
+	if (sw_porta & _BV(SIM_KEY)) {
+		sw_porta ^= _BV(SIM_KEY);
+		sim_burn(BUTTON_CYCLES);
+		fsbus_snd(SIM_CID, SIM_VS_UP, 1, 3);
+	}
+}
+
+static void sim_print(const char *name, sim_lat_t *l)
+{
+	printf("%-19s %8.2f %8.2f %8.2f\n", name, l->sl_min / (F_CPU / 1e3),
+		sim_frames ? l->sl_total / sim_frames / (F_CPU / 1e3) : 0.0, l->sl_max / (F_CPU / 1e3));
+}
+
+static void sim_run(uint32_t presses, uint8_t notify)
+{
+	static const sim_lat_t empty = { UINT32_MAX, 0, 0 };
+
+	event_init();
+	tick = 0;
+	srand(1);
+	sim_cycles = 0;
+	sim_ticks = 0;
+	sim_tick_at = SIM_TICK_CYCLES;
+	sim_key_at = SIM_US(1000 * (1 + rand() % 100));
+	sim_line = 1;
+	sim_pressed = sim_bounces = sim_waiting = 0;
+	sim_presses = sim_frames = 0;
+	sim_debounce = sim_frame = sim_total = empty;
+	sw_porta = sw_porta_state = 0;
+
+	event_register(sim_load_run, CLOCK_MS, 0);
+	if (notify)
+		switches_notify(event_register_flags(sim_buttons, 0, 0, EVENT_PRIO_HIGH));
+	else {
+		switches_notify(0);
+		event_register(sim_buttons, 100, 0);
+	}
+
+	/* fsbus_main(), sleeping to the next tick when there's nothing to do */
+	while (sim_presses < presses || sim_waiting) {
+		event_run();
+		if (!event_pending())
+			sim_burn(sim_tick_at - sim_cycles);
+	}
+
+	printf("%s, %u cycles of load a tick: %u presses, %u frames\n",
+		notify ? "switches_notify(), high priority" : "polled every 100ms",
+		sim_load, sim_presses, sim_frames);
+	printf("ms                       min     mean      max\n");
+	sim_print("press to debounced", &sim_debounce);
+	sim_print("debounced to frame", &sim_frame);
+	sim_print("press to frame", &sim_total);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t presses = argc > 1 ? atol(argv[1]) : 1000;
+
+	sim_load = argc > 2 ? atol(argv[2]) : 20000;
+	if (sim_load >= SIM_TICK_CYCLES) {
+		fprintf(stderr, "load must be under %lu cycles\n", SIM_TICK_CYCLES);
+		return 1;
+	}
+
+	sim_run(presses, 1);
+	printf("\n");
+	sim_run(presses, 0);
+	return 0;
+}
@@ -10,6 +10,7 @@ Hardware: HD44780 compatible LCD text display
 #include <stdlib.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include "lcd.h"
 
 #include <util/delay.h>
@@ -55,12 +56,55 @@ void delay_ms(uint16_t millis) {
   }
 }
 
+/*
+ * Time a full screen refresh, every character changed, with TIMER1 at
+ * clk/64. Shows how long the caller was held up and how long until the
+ * last character reached the controller, in usec. These only differ with
+ * LCD_ASYNC. Build with and without LCD_RW_HARDWIRED and LCD_ASYNC to
+ * compare the modes.
+ */
+#define TICKS_US(t)  ((uint32_t)(t) * 64 / (F_CPU / 1000000))
+
+static void refresh_time(void)
+{
+    uint16_t t_return, t_done;
+    char buffer[11];
+
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11) | _BV(CS10);
+
+    lcd_clrscr();
+    lcd_flush();
+    lcd_wait();
+
+    TCNT1 = 0;
+    lcd_puts("0123456789ABCDEF\n");
+    lcd_puts("FEDCBA9876543210");
+    lcd_flush();
+    t_return = TCNT1;
+    lcd_wait();
+    t_done = TCNT1;
+
+    delay_ms(1000);
+
+    lcd_clrscr();
+    lcd_puts("return ");
+    lcd_puts(ultoa(TICKS_US(t_return), buffer, 10));
+    lcd_puts("us\ndone   ");
+    lcd_puts(ultoa(TICKS_US(t_done), buffer, 10));
+    lcd_puts("us");
+    lcd_flush();
+}
+
 int main(void)
 {
     char buffer[7];
     int  num=134;
     
     
+    /* the LCD is written from the TIMER0 interrupt */
+    sei();
+
     /* initialize display, cursor off */
     lcd_init(LCD_DISP_ON);
 
@@ -83,6 +127,7 @@ int main(void)
         
         /* write single char to display */
         lcd_putc(':');
+        lcd_flush();
         
         /* wait until push button PD2 (INT0) is pressed */
         //wait_until_key_pressed();
@@ -97,6 +142,7 @@ int main(void)
 
         /* put string */
         lcd_puts( "CurOn");
+        lcd_flush();
         
         /* wait until push button PD2 (INT0) is pressed */
         //wait_until_key_pressed();
@@ -109,9 +155,11 @@ int main(void)
         
         lcd_clrscr();     /* clear display home cursor */
 
-        /* put string from program memory to display */
-        lcd_puts_P( "Line 1 longer than 14 characters\n" );
-        lcd_puts_P( "Line 2 longer than 14 characters" );
+        /* put string from program memory to display, a full line each
+           since the shadow drops anything past the last column */
+        lcd_puts_P( "Line 1 goes left\n" );
+        lcd_puts_P( "Line 2 goes left" );
+        lcd_flush();
         
         /* move BOTH lines one position to the left */
         lcd_command(LCD_MOVE_DISP_LEFT);
@@ -120,6 +168,9 @@ int main(void)
         //wait_until_key_pressed();
 		delay_ms(1000);
 
+        /* undo the shift, lcd_clrscr() only clears the shadow */
+        lcd_command(1<<LCD_HOME);
+
         /* turn off cursor */
         lcd_command(LCD_DISP_ON);
         
@@ -136,10 +187,17 @@ int main(void)
         
         /* put converted string to display */
         lcd_puts(buffer);
+        lcd_flush();
         
         /* wait until push button PD2 (INT0) is pressed */
         //wait_until_key_pressed();
         delay_ms(1000);
+
+        /*
+         *  Test: full screen refresh time
+         */
+        refresh_time();
+        delay_ms(3000);
         
         /*
          *  Test: Display userdefined characters
@@ -149,6 +207,7 @@ int main(void)
 	   //delay_ms(500);
        
        lcd_puts("Copyright: ");
+       lcd_flush();
        
        /*
         * load two userdefined characters from program memory
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "event.h"
+#include "clock.h"
+#include "soft_uart.h"
+#include "trace.h"
+
+#define TRACE_LINE	64		// longest line, the rest is cut off
+
+volatile uint8_t trace_mask = 0;
+volatile uint16_t trace_dropped;	// lines the soft UART had no room for
+
+/*
+ * Format a line and hand it to the soft UART if it will fit, otherwise
+ * count it and carry on
+ */
+void trace_P(PGM_P fmt, ...)
+{
+	char buf[TRACE_LINE];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf_P(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	if (!soft_uart_write(buf, len))
+		trace_dropped++;
+}
@@ -0,0 +1,70 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <avr/pgmspace.h>
+
+/*
+ * Debug output by module and level. Each module has a level fixed at build
+ * time, and anything above it compiles to nothing, format string and all.
+ * What is left can be switched on and off by module at run time from the
+ * console "trace" command.
+ *
+ *	trace_info(KAP, "kap_button_ap()\n\r");
+ *	trace_debug(FSBUS, "DOUT %d = 0x%x\n\r", i, v);
+ *
+ * Format strings stay in flash. A line goes out whole or, if the soft UART
+ * hasn't room for it, not at all (it is counted in trace_dropped), so a
+ * trace never holds up the caller.
+ *
+ * Build with -DTRACE_LEVEL=3 for everything, or -DTRACE_LEVEL_FSBUS=3 and
+ * so on for one module.
+ */
+#define TRACE_KAP		0x01	// KAP140 buttons and modes
+#define TRACE_FSBUS		0x02	// FSBUS frames in and out
+#define TRACE_DISPLAY	0x04	// KAP140 display updates
+#define TRACE_INIT		0x08	// Start up
+
+#define TRACE_OFF		0
+#define TRACE_ERR		1		// Something went wrong
+#define TRACE_INFO		2		// Things the pilot did, mode changes
+#define TRACE_DEBUG		3		// Every frame, every redraw
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL		TRACE_INFO
+#endif
+
+#ifndef TRACE_LEVEL_KAP
+#define TRACE_LEVEL_KAP		TRACE_LEVEL
+#endif
+#ifndef TRACE_LEVEL_FSBUS
+#define TRACE_LEVEL_FSBUS	TRACE_LEVEL
+#endif
+#ifndef TRACE_LEVEL_DISPLAY
+#define TRACE_LEVEL_DISPLAY	TRACE_LEVEL
+#endif
+#ifndef TRACE_LEVEL_INIT
+#define TRACE_LEVEL_INIT	TRACE_LEVEL
+#endif
+
+extern volatile uint8_t trace_mask;
+extern volatile uint16_t trace_dropped;
+
+extern void trace_P(PGM_P fmt, ...);
+
+/*
+ * True if a trace from module mod at level lvl would go out. The level test
+ * is constant, so code under a false one is thrown away by the compiler.
+ */
+#define trace_on(mod, lvl)	(TRACE_LEVEL_##mod >= (lvl) && (trace_mask & TRACE_##mod))
+
+#define trace_at(mod, lvl, fmt, ...) \
+	do { \
+		if (trace_on(mod, lvl)) \
+			trace_P(PSTR(fmt), ##__VA_ARGS__); \
+	} while (0)
+
+#define trace_err(mod, fmt, ...)	trace_at(mod, TRACE_ERR, fmt, ##__VA_ARGS__)
+#define trace_info(mod, fmt, ...)	trace_at(mod, TRACE_INFO, fmt, ##__VA_ARGS__)
+#define trace_debug(mod, fmt, ...)	trace_at(mod, TRACE_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif
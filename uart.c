@@ -32,6 +32,9 @@ NOTES:
 #ifdef DEBUG
 #include <stdio.h>
 #endif
+
+/* uart_getc() is polled from fsbus_main(), so it mustn't block */
+#define NONBLOCK
 /*
  *  constants and macros
  */
@@ -361,6 +364,18 @@ unsigned int uart_getc(void)
 }/* uart_getc */
 
 
+/*************************************************************************
+Function: uart_available()
+Purpose:  check for a received byte without taking it
+Returns:  non zero if uart_getc() has data to return
+**************************************************************************/
+unsigned char uart_available(void)
+{
+    return UART_RxHead != UART_RxTail;
+
+}/* uart_available */
+
+
 /*************************************************************************
 Function: uart_putc()
 Purpose:  write byte to ringbuffer for transmitting via UART
@@ -119,6 +119,13 @@ extern unsigned int uart_getc(void);
 
 //extern int uart_getchar(FILE *stream);
 
+/**
+ *  @brief   Check if a received byte is waiting in the ringbuffer
+ *  @param   void
+ *  @return  non zero if uart_getc() will return data
+ */
+extern unsigned char uart_available(void);
+
 /**
  *  @brief   Put byte to ringbuffer for transmitting via UART
  *  @param   data byte to be transmitted